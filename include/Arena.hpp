@@ -0,0 +1,92 @@
+/// Arena module
+///
+/// A bump allocator for the scratch memory of decoding an image. Memory
+/// is carved out of large blocks and never freed piece by piece, instead
+/// the whole arena is rewound between images. Rewinding keeps the memory,
+/// so decoding image after image of similar sizes reaches a steady state
+/// where the arena doesn't allocate or free anything.
+
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <vector>
+#include <cstddef>
+
+#include "Types.hpp"
+#include "Utility.hpp"
+
+namespace kpeg
+{
+    class Arena
+    {
+        public:
+            
+            /// The alignment of every allocation, in bytes
+            static const std::size_t ALIGNMENT = 64;
+        
+        public:
+            
+            /// Default constructor
+            ///
+            /// No memory is allocated until the first allocation.
+            ///
+            /// @param blockSize the minimum size of the blocks of memory the arena allocates
+            Arena(const std::size_t blockSize = 64 * 1024);
+            
+            /// Allocate memory for an array of objects
+            ///
+            /// The objects are not constructed, the memory is only valid
+            /// until the arena is rewound.
+            ///
+            /// @param count the number of objects
+            /// @return the memory, aligned to ALIGNMENT bytes
+            template <typename T>
+            T* allocate(const std::size_t count)
+            {
+                return static_cast<T*>(allocate(count * sizeof(T)));
+            }
+            
+            /// Allocate memory
+            ///
+            /// @param size the number of bytes
+            /// @return the memory, aligned to ALIGNMENT bytes
+            void* allocate(const std::size_t size);
+            
+            /// Make all the memory of the arena available again
+            ///
+            /// Everything allocated before is invalidated. If the last use
+            /// needed several blocks, they are merged into a single block
+            /// big enough for all of it, so the next use of the same size
+            /// fits in it.
+            void rewind();
+            
+            /// Get the number of bytes allocated since the arena was last rewound
+            ///
+            /// @return the number of bytes in use
+            std::size_t getUsedSize() const;
+            
+            /// Get the number of bytes the arena holds
+            ///
+            /// @return the total size of the blocks
+            std::size_t getCapacity() const;
+        
+        private:
+            
+            typedef std::vector<UInt8, utils::AlignedAllocator<UInt8, ALIGNMENT>> Block;
+            
+            /// The minimum size of a block
+            std::size_t m_blockSize;
+            
+            /// The blocks of memory, those before the current one are full
+            std::vector<Block> m_blocks;
+            
+            /// The block allocations are made from, and the offset of its free memory
+            std::size_t m_current;
+            std::size_t m_offset;
+            
+            /// The bytes allocated from the blocks before the current one
+            std::size_t m_usedBefore;
+    };
+}
+
+#endif // ARENA_HPP
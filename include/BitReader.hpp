@@ -0,0 +1,185 @@
+/// Bit reader module
+///
+/// Reads the entropy coded image scan data bit by bit, most
+/// significant bit first, the way the JPEG Huffman codes are packed.
+
+#ifndef BIT_READER_HPP
+#define BIT_READER_HPP
+
+#include <cstring>
+#include <cstdint>
+
+#include "Types.hpp"
+
+namespace kpeg
+{
+    /// Load 8 bytes from a possibly unaligned address as a big endian value
+    ///
+    /// @param bytes address of the first byte to load
+    /// @return the value of the 8 bytes, with the first byte as the most significant
+    inline std::uint64_t loadBigEndian64(const UInt8* bytes)
+    {
+        std::uint64_t value;
+        std::memcpy(&value, bytes, sizeof(value));
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        value = __builtin_bswap64(value);
+#endif
+        return value;
+    }
+
+    /// BitReader is an abstraction for reading bits from the compressed scan data
+    ///
+    /// The bits are buffered in a 64-bit accumulator (the bit reservoir),
+    /// with the next unread bit in its most significant position. The
+    /// reservoir is refilled with a single unaligned 8-byte load, so
+    /// the scan data must already have its stuffed bytes removed.
+    ///
+    /// Reading past the end of the scan data yields zero bits.
+    class BitReader
+    {
+        public:
+
+            /// Default constructor
+            BitReader() :
+             m_data{ nullptr } ,
+             m_size{ 0 } ,
+             m_pos{ 0 } ,
+             m_buffer{ 0 } ,
+             m_bitCount{ 0 }
+            {}
+
+            /// Initialize the bit reader with the specified scan data
+            ///
+            /// @param data the (unstuffed) scan data
+            /// @param size the size of the scan data, in bytes
+            BitReader(const UInt8* data, const std::size_t size) :
+             m_data{ data } ,
+             m_size{ size } ,
+             m_pos{ 0 } ,
+             m_buffer{ 0 } ,
+             m_bitCount{ 0 }
+            {}
+
+            /// Move to the specified bit in the scan data
+            ///
+            /// @param bitPosition the index of the next bit to read
+            void seek(const std::size_t bitPosition)
+            {
+                m_pos = bitPosition / 8;
+                m_buffer = 0;
+                m_bitCount = 0;
+
+                if (bitPosition % 8 != 0)
+                    getBits(bitPosition % 8);
+            }
+
+            /// Get the position of the next bit to read in the scan data
+            ///
+            /// @return the index of the next bit to read
+            std::size_t bitPosition() const
+            {
+                return m_pos * 8 - m_bitCount;
+            }
+
+            /// Look at the next bits without consuming them
+            ///
+            /// @param count the number of bits to look at, 1 to 32
+            /// @return the next count bits, right aligned
+            std::uint32_t peekBits(const int count)
+            {
+                if (m_bitCount < count)
+                    refill();
+
+                return std::uint32_t(m_buffer >> (64 - count));
+            }
+
+            /// Consume bits that were previously looked at with peekBits
+            ///
+            /// @param count the number of bits to consume
+            void consumeBits(const int count)
+            {
+                m_buffer <<= count;
+                m_bitCount -= count;
+            }
+
+            /// Read the next bits
+            ///
+            /// @param count the number of bits to read, 1 to 32
+            /// @return the next count bits, right aligned
+            std::uint32_t getBits(const int count)
+            {
+                std::uint32_t bits = peekBits(count);
+                consumeBits(count);
+                return bits;
+            }
+
+            /// Read a coefficient value of the specified category
+            ///
+            /// A value of category (bit length) s is stored in s bits, with
+            /// negative values stored as the s-bit one's complement, this
+            /// is the EXTEND procedure from ITU-T.81, section F.2.2.1
+            ///
+            /// @param category the category of the value to read, 0 to 16
+            /// @return the signed value
+            int receiveExtend(const int category)
+            {
+                if (category == 0)
+                    return 0;
+
+                int value = (int)getBits(category);
+
+                // A leading 0 bit denotes a negative value
+                if (value < (1 << (category - 1)))
+                    value -= (1 << category) - 1;
+
+                return value;
+            }
+
+        private:
+
+            /// Top up the bit reservoir to at least 56 bits
+            void refill()
+            {
+                if (m_pos + 8 <= m_size)
+                {
+                    // Load 8 bytes at once, the bits that don't fit in the
+                    // reservoir are loaded again by the next refill
+                    m_buffer |= loadBigEndian64(m_data + m_pos) >> m_bitCount;
+
+                    int bytes = (63 - m_bitCount) >> 3;
+                    m_pos += bytes;
+                    m_bitCount += bytes * 8;
+                    return;
+                }
+
+                // Close to the end of the scan data, go byte by byte
+                while (m_bitCount <= 56)
+                {
+                    std::uint64_t byte = m_pos < m_size ? m_data[m_pos] : 0x00;
+                    m_buffer |= byte << (56 - m_bitCount);
+                    m_pos++;
+                    m_bitCount += 8;
+                }
+            }
+
+        private:
+
+            // The scan data
+            const UInt8* m_data;
+
+            // Size of the scan data in bytes
+            std::size_t m_size;
+
+            // Index of the next byte to load into the reservoir
+            std::size_t m_pos;
+
+            // The bit reservoir, the next bit is the most significant bit
+            std::uint64_t m_buffer;
+
+            // Number of valid bits in the reservoir
+            int m_bitCount;
+    };
+}
+
+#endif // BIT_READER_HPP
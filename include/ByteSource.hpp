@@ -0,0 +1,226 @@
+/// Byte source module
+///
+/// Where the decoder reads the JFIF data from. A byte source exposes all
+/// its bytes as a single contiguous range, either a buffer in memory or
+/// a file mapped into memory, so the compressed data is never copied
+/// through stream buffers a few bytes at a time.
+///
+/// The byte reader walks such a range with bounds checks, the segment
+/// parsers read through it and can never read past the end of their
+/// segment.
+
+#ifndef BYTE_SOURCE_HPP
+#define BYTE_SOURCE_HPP
+
+#include <string>
+#include <cstddef>
+
+#include "Types.hpp"
+
+namespace kpeg
+{
+    /// Interface of the sources of JFIF data
+    class ByteSource
+    {
+        public:
+            
+            virtual ~ByteSource() {}
+            
+            /// Get the bytes of the source
+            ///
+            /// @return the first byte, nullptr if the source is empty
+            virtual const UInt8* getData() const = 0;
+            
+            /// Get the number of bytes in the source
+            ///
+            /// @return the size of the source, in bytes
+            virtual std::size_t getSize() const = 0;
+    };
+    
+    /// Byte source over a buffer owned by the caller
+    ///
+    /// The buffer isn't copied, it must outlive the source.
+    class MemorySource : public ByteSource
+    {
+        public:
+            
+            /// Default constructor, an empty source
+            MemorySource();
+            
+            /// Initialize the source with the buffer
+            ///
+            /// @param data the bytes of the JFIF data
+            /// @param size the number of bytes
+            MemorySource(const UInt8* data, const std::size_t size);
+            
+            const UInt8* getData() const override;
+            
+            std::size_t getSize() const override;
+        
+        private:
+            
+            const UInt8* m_data;
+            std::size_t m_size;
+    };
+    
+    /// Byte source over a file mapped into memory
+    ///
+    /// The mapping is advised to be read sequentially (MADV_SEQUENTIAL),
+    /// so the kernel reads ahead of the decoder and drops the pages
+    /// behind it.
+    class MappedFileSource : public ByteSource
+    {
+        public:
+            
+            /// Default constructor, no file mapped
+            MappedFileSource();
+            
+            /// Destructor, unmaps the file
+            ~MappedFileSource();
+            
+            MappedFileSource(const MappedFileSource&) = delete;
+            MappedFileSource& operator=(const MappedFileSource&) = delete;
+            
+            /// Map a file into memory, unmapping the previous one
+            ///
+            /// @param filename the path of the file
+            /// @return true if the file was mapped, else false
+            bool open(const std::string& filename);
+            
+            /// Unmap the file
+            void close();
+            
+            const UInt8* getData() const override;
+            
+            std::size_t getSize() const override;
+        
+        private:
+            
+            void* m_mapping;
+            std::size_t m_size;
+    };
+    
+    /// Bounds-checked reader of a range of bytes
+    ///
+    /// Reading past the end of the range yields zero bytes and marks the
+    /// reader as overrun, so a parser can read a whole structure and
+    /// check once that it was all there.
+    class ByteReader
+    {
+        public:
+            
+            /// Default constructor, an empty range
+            ByteReader() :
+             m_begin{ nullptr } ,
+             m_current{ nullptr } ,
+             m_end{ nullptr } ,
+             m_overrun{ false }
+            {}
+            
+            /// Initialize the reader with the range of bytes
+            ///
+            /// @param data the first byte of the range
+            /// @param size the number of bytes in the range
+            ByteReader(const UInt8* data, const std::size_t size) :
+             m_begin{ data } ,
+             m_current{ data } ,
+             m_end{ data + size } ,
+             m_overrun{ false }
+            {}
+            
+            /// Read the next byte
+            ///
+            /// @return the byte, 0 past the end of the range
+            UInt8 readByte()
+            {
+                if (m_current == m_end)
+                {
+                    m_overrun = true;
+                    return 0;
+                }
+                
+                return *m_current++;
+            }
+            
+            /// Read the next two bytes as a big endian value
+            ///
+            /// @return the value, 0 past the end of the range
+            UInt16 readWord()
+            {
+                if (m_end - m_current < 2)
+                {
+                    m_current = m_end;
+                    m_overrun = true;
+                    return 0;
+                }
+                
+                UInt16 value = UInt16((m_current[0] << 8) | m_current[1]);
+                m_current += 2;
+                
+                return value;
+            }
+            
+            /// Get a reader over the next bytes and skip them
+            ///
+            /// @param size the number of bytes
+            /// @return the reader over the bytes, cut short at the end of the range
+            ByteReader readBlock(const std::size_t size)
+            {
+                const UInt8* block = m_current;
+                skip(size);
+                
+                return ByteReader(block, m_current - block);
+            }
+            
+            /// Skip bytes
+            ///
+            /// @param count the number of bytes to skip
+            void skip(const std::size_t count)
+            {
+                if (getRemaining() < count)
+                {
+                    m_current = m_end;
+                    m_overrun = true;
+                    return;
+                }
+                
+                m_current += count;
+            }
+            
+            /// Get the next byte to read
+            ///
+            /// @return pointer to the next byte
+            const UInt8* getCurrent() const { return m_current; }
+            
+            /// Get the offset of the next byte to read in the range
+            ///
+            /// @return the number of bytes read or skipped
+            std::size_t getPosition() const { return m_current - m_begin; }
+            
+            /// Get the number of bytes left to read
+            ///
+            /// @return the number of bytes after the position
+            std::size_t getRemaining() const { return m_end - m_current; }
+            
+            /// Get the number of bytes in the range
+            ///
+            /// @return the size of the range
+            std::size_t getSize() const { return m_end - m_begin; }
+            
+            /// Check whether everything read so far was in the range
+            ///
+            /// @return true if nothing was read past the end of the range, else false
+            bool isGood() const { return !m_overrun; }
+        
+        private:
+            
+            const UInt8* m_begin;
+            const UInt8* m_current;
+            const UInt8* m_end;
+            
+            // Whether a read went past the end of the range
+            bool m_overrun;
+    };
+}
+
+#endif // BYTE_SOURCE_HPP
@@ -0,0 +1,142 @@
+/// Color conversion module
+///
+/// Kernels converting rows of Y, Cb and Cr samples to packed 8-bit RGB
+/// pixels, as specified by JFIF. The conversion is done in fixed point
+/// with 14 fractional bits, rounding to nearest and saturating.
+///
+/// Subsampled chrominance is upsampled by the kernels themselves, on the
+/// fly, so a full resolution copy of the chrominance never exists. The
+/// kernels take the chrominance rows at the resolution they were coded
+/// at, halved horizontally for 4:2:2 and 4:2:0 images.
+///
+/// The kernels are templates over the packed pixel format they write
+/// (RGB8, BGR8, RGBA8 or BGRA8) and the upsampling they do, so neither
+/// costs anything in the inner loops.
+
+#ifndef COLOR_CONVERSION_HPP
+#define COLOR_CONVERSION_HPP
+
+#include <cstddef>
+
+#include "Types.hpp"
+
+namespace kpeg
+{
+    /// Fixed-point (14 fractional bits) factors of the YCbCr to RGB conversion
+    const int YCC_FIX_BITS = 14;
+    const int YCC_CR_TO_R = 22970;  // 1.402
+    const int YCC_CB_TO_G = -5638;  // -0.344136
+    const int YCC_CR_TO_G = -11700; // -0.714136
+    const int YCC_CB_TO_B = 29032;  // 1.772
+
+    /// Chrominance upsampling modes
+    enum UpsamplingMode
+    {
+        UPSAMPLING_SIMPLE, // Each chrominance sample covers all its pixels
+        UPSAMPLING_FANCY   // Triangle filter, each pixel weighs the nearest samples 3:1
+    };
+
+    /// Layout of the pixels of a packed RGB pixel format
+    template <PixelFormat FORMAT>
+    struct PackedRGBLayout
+    {
+        static_assert(FORMAT == PIXEL_FORMAT_RGB8  || FORMAT == PIXEL_FORMAT_BGR8 ||
+                      FORMAT == PIXEL_FORMAT_RGBA8 || FORMAT == PIXEL_FORMAT_BGRA8,
+                      "not a packed RGB pixel format");
+
+        /// Byte offsets of the channels in a pixel
+        static const int RED   = FORMAT == PIXEL_FORMAT_BGR8 || FORMAT == PIXEL_FORMAT_BGRA8 ? 2 : 0;
+        static const int GREEN = 1;
+        static const int BLUE  = 2 - RED;
+        static const int ALPHA = 3;
+
+        /// Number of bytes per pixel, the alpha channel is always opaque (255)
+        static const int PIXEL_SIZE = FORMAT == PIXEL_FORMAT_RGBA8 || FORMAT == PIXEL_FORMAT_BGRA8 ? 4 : 3;
+    };
+
+    /// Signature of a YCbCr to RGB row conversion kernel
+    ///
+    /// Fancy upsampling of vertically subsampled chrominance blends the
+    /// nearest chrominance row of each pixel row with the next nearest
+    /// (far) one, otherwise the far rows are the same as the near ones.
+    ///
+    /// Horizontally subsampled chrominance rows must have one readable
+    /// sample on each side of the samples covering the pixels, fancy
+    /// upsampling uses them at the ends of the row.
+    ///
+    /// @param Y the row of luminance samples
+    /// @param Cb the nearest row of blue chrominance samples
+    /// @param Cr the nearest row of red chrominance samples
+    /// @param CbFar the next nearest row of blue chrominance samples
+    /// @param CrFar the next nearest row of red chrominance samples
+    /// @param output the row of pixels to write, in the pixel format of the kernel
+    /// @param count the number of pixels in the row
+    typedef void (*ColorConversionFunction)(const UInt8* Y,
+                                            const UInt8* Cb,
+                                            const UInt8* Cr,
+                                            const UInt8* CbFar,
+                                            const UInt8* CrFar,
+                                            UInt8* output,
+                                            const std::size_t count);
+
+    /// Scalar YCbCr to RGB conversion
+    ///
+    /// This is also how the SIMD kernels convert the pixels at the end
+    /// of a row that don't fill a vector.
+    ///
+    /// @param format the packed RGB pixel format to convert to
+    /// @param hFactor the horizontal subsampling of the chrominance: 1 or 2
+    /// @param mode the upsampling mode
+    void convertYCbCrToRGB(const UInt8* Y, const UInt8* Cb, const UInt8* Cr,
+                           const UInt8* CbFar, const UInt8* CrFar,
+                           UInt8* output, const std::size_t count,
+                           const PixelFormat format, const int hFactor, const UpsamplingMode mode);
+
+    /// Get the SSE2 YCbCr to RGB conversion kernel, 16 pixels at a time
+    ///
+    /// Only available on x86 builds.
+    ///
+    /// @param format the packed RGB pixel format to convert to
+    /// @param hFactor the horizontal subsampling of the chrominance: 1 or 2
+    /// @param mode the upsampling mode
+    /// @return the conversion kernel
+    ColorConversionFunction getYCbCrToRGBFunctionSSE2(const PixelFormat format, const int hFactor, const UpsamplingMode mode);
+
+    /// Get the AVX2 YCbCr to RGB conversion kernel, 32 pixels at a time
+    ///
+    /// Only available on x86 builds, and must only be called on CPUs supporting AVX2.
+    ///
+    /// @param format the packed RGB pixel format to convert to
+    /// @param hFactor the horizontal subsampling of the chrominance: 1 or 2
+    /// @param mode the upsampling mode
+    /// @return the conversion kernel
+    ColorConversionFunction getYCbCrToRGBFunctionAVX2(const PixelFormat format, const int hFactor, const UpsamplingMode mode);
+
+    /// Get the fastest YCbCr to RGB conversion kernel the CPU supports
+    ///
+    /// @param format the packed RGB pixel format to convert to
+    /// @param hFactor the horizontal subsampling of the chrominance: 1 or 2
+    /// @param mode the upsampling mode
+    /// @return the conversion kernel, nullptr if the format isn't a packed RGB format
+    ColorConversionFunction getYCbCrToRGBFunction(const PixelFormat format = PIXEL_FORMAT_RGB8,
+                                                  const int hFactor = 1,
+                                                  const UpsamplingMode mode = UPSAMPLING_FANCY);
+
+    /// Upsample a row of chrominance samples to full resolution
+    ///
+    /// The upsampled samples are the same as the ones the conversion
+    /// kernels compute internally. The same requirements on the rows
+    /// apply.
+    ///
+    /// @param near the nearest row of chrominance samples
+    /// @param far the next nearest row of chrominance samples
+    /// @param output the row of upsampled samples
+    /// @param count the number of samples to output
+    /// @param hFactor the horizontal subsampling of the chrominance: 1 or 2
+    /// @param mode the upsampling mode
+    void upsampleChromaRow(const UInt8* near, const UInt8* far,
+                           UInt8* output, const std::size_t count,
+                           const int hFactor, const UpsamplingMode mode);
+}
+
+#endif // COLOR_CONVERSION_HPP
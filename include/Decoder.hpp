@@ -1,27 +1,29 @@
 /// A simple abstraction for the decoder of a JPEG decoder
 ///
 /// Decoder module is the implementation of a 8-bit Sequential
-/// Baseline DCT, grayscale/RGB encoder with no subsampling (4:4:4)
+/// Baseline DCT, grayscale/RGB encoder with 4:4:4, 4:2:2, 4:4:0
+/// or 4:2:0 chroma subsampling
 
 #ifndef DECODER_HPP
 #define DECODER_HPP
 
-#include <fstream>
 #include <vector>
 #include <utility>
-#include <bitset>
 
 #include "Types.hpp"
 #include "Image.hpp"
-#include "HuffmanTree.hpp"
+#include "HuffmanDecoder.hpp"
+#include "BitReader.hpp"
 #include "MCU.hpp"
+#include "Arena.hpp"
+#include "ByteSource.hpp"
 
 namespace kpeg
 {
     class Decoder
     {
         public:
-
+            
             /// The result of a decode operation
             enum ResultCode
             {
@@ -29,9 +31,11 @@ namespace kpeg
                 TERMINATE,
                 ERROR,
                 DECODE_INCOMPLETE,
-                DECODE_DONE
+                DECODE_DONE,
+                BUFFER_TOO_SMALL,
+                NEED_MORE_DATA
             };
-            
+        
         public:
             
             /// Default constructor
@@ -44,67 +48,491 @@ namespace kpeg
             ~Decoder();
             
             /// Open a JFIF image file for decoding
+            ///
+            /// The file is mapped into memory rather than read. The decoder
+            /// is reset first, so the same decoder can decode any number of
+            /// images one after the other.
             bool open(const std::string& filename);
             
+            /// Open JFIF data in memory for decoding
+            ///
+            /// The data isn't copied, it must stay valid until the image is
+            /// decoded or the decoder is closed.
+            ///
+            /// @param data the JFIF data
+            /// @param size the size of the data, in bytes
+            /// @return true if there is data to decode, else false
+            bool open(const UInt8* data, const std::size_t size);
+            
+            /// Open JFIF data from a byte source for decoding
+            ///
+            /// The source must stay valid until the image is decoded or the
+            /// decoder is closed.
+            ///
+            /// @param source the source of the JFIF data
+            /// @return true if there is data to decode, else false
+            bool open(const ByteSource& source);
+            
+            /// Forget the current image, getting ready to decode the next one
+            ///
+            /// The file is closed and all the state of the image is dropped,
+            /// but the memory used to decode it is kept: the scan data, the
+            /// image buffers and the arena the MCUs are allocated from. Once
+            /// images of similar sizes have been decoded, decoding the next
+            /// one allocates next to nothing. The decoding options (threads,
+            /// scale, IDCT kernel, pixel format and upsampling) are kept.
+            void reset();
+            
+            /// Read the JFIF file up to the frame header
+            ///
+            /// Once the header is read the size of the image, given by the
+            /// width and height of getImage(), and its pixel format are
+            /// known, e.g., to allocate a buffer for decodeImageFile.
+            /// Decoding continues from where the header ends.
+            ///
+            /// @return SUCCESS if the frame header was read, else why not
+            ResultCode readHeader();
+            
+            /// Get the pixel format the image is decoded to
+            ///
+            /// For grayscale images it depends on the frame header.
+            ///
+            /// @return the pixel format
+            PixelFormat getPixelFormat() const;
+            
             /// Decode the image in the JFIF file
             ResultCode decodeImageFile();
-
-            /// Write raw, uncompressed image data to disk in PPM format
+            
+            /// Decode the image in the JFIF file into a buffer owned by the caller
+            ///
+            /// The pixels are written straight into the buffer, in the pixel
+            /// format given by getPixelFormat, laid out as described by
+            /// getImageBufferSize. The image returned by getImage refers to
+            /// the buffer. The header is read first if it hasn't been yet.
+            ///
+            /// @param buffer the buffer to decode the image into
+            /// @param size the size of the buffer, in bytes
+            /// @param stride the number of bytes between the rows of the first plane, 0 for rows without padding
+            /// @return DECODE_DONE if the image was decoded, BUFFER_TOO_SMALL if it doesn't fit in the buffer, else why not
+            ResultCode decodeImageFile(UInt8* buffer, const std::size_t size, const std::size_t stride = 0);
+            
+            /// Decode JFIF data fed to the decoder in chunks, as it arrives
+            ///
+            /// The chunks may be of any size and split the data anywhere,
+            /// they're parsed as far as they go and the decoder picks up
+            /// from there, in the middle of a segment or of a Huffman code,
+            /// when the next chunk is fed. Each row of MCUs is added to the
+            /// image as soon as its scan data is in, so the top rows of the
+            /// image, up to getImage().getCompletedRowCount(), are ready
+            /// before the rest of the data arrives. The image is decoded
+            /// into its own buffer, on a single thread. Feeding can't be
+            /// mixed with open(), reset() the decoder before feeding the
+            /// next image.
+            ///
+            /// @param data the next chunk of JFIF data, it's copied
+            /// @param size the size of the chunk, 0 once there is no more data
+            /// @return NEED_MORE_DATA until the image is decoded, then DECODE_DONE, else why not
+            ResultCode feed(const UInt8* data, const std::size_t size);
+            
+            /// Decode the JFIF file only up to the quantized DCT coefficients
+            ///
+            /// Decoding stops after the entropy decoding, the IDCT and
+            /// color conversion aren't done and the image is left empty.
+            /// The coefficients of each component are then available from
+            /// getCoefficients. The scale, pixel format and upsampling
+            /// mode don't apply.
+            ///
+            /// @return DECODE_DONE if the coefficients were decoded, else why not
+            ResultCode decodeCoefficients();
+            
+            /// Get the number of components in the frame
+            ///
+            /// @return 1 for grayscale images, 3 for color images, 0 until the header is read
+            int getComponentCount() const;
+            
+            /// Get the quantized DCT coefficients of a component
+            ///
+            /// @param component the index of the component in the frame (0 = Y, 1 = Cb, 2 = Cr)
+            /// @return the coefficients, empty until decodeCoefficients is called
+            const ComponentCoefficients& getCoefficients(const int component) const;
+            
+            /// Write raw, uncompressed image data to disk
+            ///
+            /// The file is named after the JFIF file, with the extension
+            /// given by getRawFileExtension for the pixel format.
             bool dumpRawData();
-
-            /// Close the JFIF file
+            
+            /// Get the decoded image
+            ///
+            /// @return the image, empty until an image is decoded
+            const Image& getImage() const;
+            
+            /// Set the number of threads used for decoding
+            ///
+            /// The restart intervals of images with restart markers
+            /// are entropy decoded in parallel. By default a single
+            /// thread is used.
+            ///
+            /// @param threads the number of threads, 0 for one per core
+            void setThreadCount(const unsigned threads);
+            
+            /// Enable or disable speculative parallel decoding
+            ///
+            /// Scans without restart markers can only be decoded serially
+            /// from their first bit. With speculative decoding enabled, the
+            /// scan is split into chunks that are decoded in parallel from
+            /// guessed starting points, relying on the Huffman codes to
+            /// self-synchronize. Only used with more than one thread.
+            ///
+            /// @param enabled true to enable speculative decoding
+            void setSpeculativeDecoding(const bool enabled);
+            
+            /// Set the scale of the decoded image
+            ///
+            /// Decoding at 1/2, 1/4 or 1/8 scale uses 4x4, 2x2 or 1x1
+            /// inverse transforms instead of 8x8 ones, a 1/8 scale image
+            /// only needs the DC coefficients. The image size is rounded
+            /// up. Must be set before decoding.
+            ///
+            /// @param denominator the scale denominator: 1, 2, 4 or 8
+            /// @return true if the scale is supported, else false
+            bool setScale(const unsigned denominator);
+            
+            /// Select the IDCT kernel
+            ///
+            /// By default (IDCT_AUTO) the fastest kernel the CPU supports
+            /// is used, the floating point reference IDCT is much slower.
+            ///
+            /// @param kernel the IDCT kernel to use
+            void setIDCTKernel(const IDCTKernel kernel);
+            
+            /// Set the pixel format of the decoded image
+            ///
+            /// By default color images are converted to packed RGB and
+            /// grayscale images are decoded to GRAY8. Decoding to grayscale
+            /// or planar YCbCr skips color conversion, grayscale images
+            /// decoded to RGB formats have R = G = B. Must be set before
+            /// decoding.
+            ///
+            /// @param format the pixel format
+            void setPixelFormat(const PixelFormat format);
+            
+            /// Set how subsampled chrominance is upsampled
+            ///
+            /// By default (UPSAMPLING_FANCY) the chrominance is interpolated
+            /// with a triangle filter, simple upsampling repeats each sample
+            /// and is slightly faster. Must be set before decoding.
+            ///
+            /// @param mode the upsampling mode
+            void setUpsamplingMode(const UpsamplingMode mode);
+            
+            /// Close the JFIF file or stop reading the JFIF data
             void close();
-                        
+        
         private:
-
+            
             /// Parse the info of the specified segment in the JFIF file
-            ResultCode parseSegmentInfo(const UInt8 byte);
+            ///
+            /// The segment parsers read the bytes of their segment, after
+            /// its length, through a reader bounded to the segment.
+            ///
+            /// @param byte the second byte of the marker
+            /// @param segment the reader over the segment, empty for markers without one
+            /// @return SUCCESS if the segment was parsed, else why not
+            ResultCode parseSegmentInfo(const UInt8 byte, ByteReader& segment);
             
             /// Parse the JFIF segment at the very beginning of the JFIF file
-            void parseAPP0Segment();
-
+            ResultCode parseAPP0Segment(ByteReader& segment);
+            
             /// Parse the comment in the JFIF file
-            void parseCOMSegment();
+            ResultCode parseCOMSegment(ByteReader& segment);
             
             /// Parse the quantization tables specified in the JFIF file
-            void parseDQTSegment();
+            ResultCode parseDQTSegment(ByteReader& segment);
             
             /// Parse the Start of File segment
-            ResultCode parseSOF0Segment();
+            ResultCode parseSOF0Segment(ByteReader& segment);
             
             /// Parse the Huffman tables specified in the JFIF file
-            void parseDHTSegment();
+            ResultCode parseDHTSegment(ByteReader& segment);
+            
+            /// Parse the restart interval specified in the JFIF file
+            ResultCode parseDRISegment(ByteReader& segment);
             
             /// Parse the start of scan segment in the JFIF file
-            void parseSOSSegment();
+            ResultCode parseSOSSegment(ByteReader& segment);
+            
+            /// Parse the segments of the JFIF file
+            ///
+            /// Parsing stops at the end of the image (EOI marker). When
+            /// the data is fed, parsing also stops at the start of the scan
+            /// data and when the data runs out in the middle of a marker,
+            /// leaving the reader at the marker.
+            ///
+            /// @param untilFrame true to stop after the frame header (SOF segment)
+            /// @return SUCCESS if stopped after the frame header or at fed scan data, DECODE_DONE at the end of the file,
+            ///         NEED_MORE_DATA if the fed data ran out, else why it stopped
+            ResultCode parseSegments(const bool untilFrame);
+            
+            /// Check that the quantization tables of all the components are defined
+            ///
+            /// @return true if they are, else false
+            bool hasQuantizationTables() const;
+            
+            /// Decode the image in the JFIF file
+            ///
+            /// @param buffer the caller's buffer to decode the image into, nullptr for the image's own
+            /// @param stride the number of bytes between the rows of the first plane of the caller's buffer
+            /// @param coefficientsOnly true to stop after entropy decoding, keeping the coefficients
+            /// @return DECODE_DONE if the image was decoded, else why not
+            ResultCode decode(UInt8* buffer, const std::size_t stride, const bool coefficientsOnly = false);
             
             /// Parse the actual compressed image data stored in the JFIF file
+            ///
+            /// The scan data is copied out of the source in bulk, removing
+            /// the stuffed bytes (XXFF00YY is stored for XXFFYY) and taking
+            /// the restart markers out of the scan data, with their offsets
+            /// recorded.
             void scanImageData();
             
-            // Convert bytes of the form XXFF00YY to just XXFFYY
-            void byteStuffScanData();
-            
             /// Decode the RLE-Huffman encoded image pixel data
             ///
-            /// This function goes bit by bit over the image scan data
+            /// This function reads the image scan data through a bit reader
             /// and decodes it using the provided DC and AC Huffman tables
-            /// for luminance (Y) and chrominance (Cb & Cr)
-            void decodeScanData();
+            /// for luminance (Y) and chrominance (Cb & Cr). The MCUs are
+            /// added to the image, which must be started, a row at a time.
+            ///
+            /// @param coefficientsOnly true to keep the coefficients of the MCUs instead
+            /// @return true if the scan was decoded, false if there's no scan data
+            bool decodeScanData(const bool coefficientsOnly);
             
+            /// The layout of the scan in MCUs and how they're turned into the image
+            struct ScanLayout
+            {
+                /// The number of MCUs in a row, the number of rows and of MCUs
+                int MCUsPerRow;
+                int MCURows;
+                int MCUCount;
+                
+                /// The number of restart intervals in the scan data
+                std::size_t intervalCount;
+                
+                /// The IDCT kernel constructing the MCUs
+                IDCTFunction idct;
+                
+                /// The quantization table of each block in an MCU
+                const DequantizationTable** tables;
+                
+                /// Whether the coefficients of the MCUs are kept instead
+                bool coefficientsOnly;
+            };
+            
+            /// Get the layout of the scan from the frame
+            ///
+            /// The number of restart intervals is the number the restart
+            /// interval calls for, the scan data may have fewer.
+            ///
+            /// @param coefficientsOnly true to keep the coefficients of the MCUs instead
+            /// @return the layout of the scan
+            ScanLayout getScanLayout(const bool coefficientsOnly) const;
+            
+            /// Check the restart markers found against the number of restart intervals
+            ///
+            /// If markers are missing, the last interval found takes the
+            /// rest of the MCUs.
+            ///
+            /// @param scan the layout of the scan, its interval count is updated
+            void checkRestartMarkers(ScanLayout& scan) const;
+            
+            /// Allocate the MCUs and prepare the IDCT or the coefficient planes
+            ///
+            /// @param scan the layout of the scan, its IDCT kernel and tables are set
+            /// @param MCUsKept the number of MCUs to allocate
+            void startScan(ScanLayout& scan, const std::size_t MCUsKept);
+            
+            /// Pass a decoded row of MCUs on to the image, or to the coefficients
+            ///
+            /// @param scan the layout of the scan
+            /// @param MCURow the index of the row of MCUs
+            /// @param MCUs the MCUs of the row
+            void finishMCURow(const ScanLayout& scan, const int MCURow, MCU* MCUs);
+            
+            /// Release the MCUs once the whole scan is decoded
+            ///
+            /// @param corrupt true if the scan data is corrupt
+            void finishScan(const bool corrupt);
+            
+            /// Start decoding the scan of fed data, once its SOS segment is parsed
+            void startFedScan();
+            
+            /// Take in the fed scan data and decode the MCUs it completes
+            ///
+            /// @return SUCCESS once the scan is decoded, NEED_MORE_DATA until then
+            ResultCode feedScanData();
+            
+            /// Decode the MCUs whose scan data has arrived
+            ///
+            /// An MCU is decoded tentatively, and kept only if it didn't read
+            /// past the scan data that has arrived, else it's decoded again
+            /// once more has. Each row of MCUs is added to the image once
+            /// its last MCU is decoded.
+            ///
+            /// @param complete true if all the scan data has arrived
+            void decodeFedMCUs(const bool complete);
+            
+            /// Copy the coefficients of a row of MCUs to the coefficients of the components
+            ///
+            /// @param MCURow the index of the row of MCUs
+            /// @param MCUsPerRow the number of MCUs in a row
+            /// @param MCUs the MCUs of the row
+            void storeCoefficients(const int MCURow, const int MCUsPerRow, MCU* MCUs);
+            
+            /// State of the entropy decoder between rows of MCUs, when
+            /// the scan data is decoded serially
+            struct ScanPosition
+            {
+                /// The bit reader over the scan data of the restart interval
+                BitReader reader;
+                
+                /// The DC predictions of the components
+                int DCPredictor[3];
+                
+                /// The index of the restart interval
+                std::size_t interval;
+                
+                /// Whether the restart interval is corrupt
+                bool corrupt;
+            };
+            
+            /// Start decoding a restart interval
+            ///
+            /// @param position the state of the entropy decoder to reset
+            /// @param interval the index of the restart interval
+            /// @param intervalCount the number of restart intervals in the scan data
+            void startRestartInterval(ScanPosition& position,
+                                      const std::size_t interval,
+                                      const std::size_t intervalCount) const;
+            
+            /// Get a bit reader over the scan data of a restart interval
+            ///
+            /// An interval without a restart marker after it runs to the
+            /// end of the scan data, as far as it goes.
+            ///
+            /// @param interval the index of the restart interval
+            /// @param intervalCount the number of restart intervals in the scan data
+            /// @return the bit reader, at the start of the interval
+            BitReader getIntervalReader(const std::size_t interval, const std::size_t intervalCount) const;
+            
+            /// Decode the MCUs of one row of MCUs, continuing from the previous row
+            ///
+            /// @param position the state of the entropy decoder
+            /// @param firstMCU the index of the first MCU of the row in the image
+            /// @param count the number of MCUs in the row
+            /// @param intervalCount the number of restart intervals in the scan data
+            /// @param MCUs the MCUs to write the coefficients to
+            /// @return true if the MCUs were decoded, false if the scan data is corrupt
+            bool decodeMCURow(ScanPosition& position,
+                              const int firstMCU,
+                              const int count,
+                              const std::size_t intervalCount,
+                              MCU* MCUs) const;
+            
+            /// Decode the MCUs of one restart interval
+            ///
+            /// Restart intervals are independent of each other, the DC
+            /// predictions are reset and the interval starts byte aligned.
+            ///
+            /// @param data the scan data of the restart interval
+            /// @param size the size of the scan data of the restart interval
+            /// @param firstMCU the index of the first MCU in the restart interval
+            /// @param endMCU the index past the last MCU in the restart interval
+            /// @return true if the MCUs were decoded, false if the scan data is corrupt
+            bool decodeRestartInterval(const UInt8* data,
+                                       const std::size_t size,
+                                       const int firstMCU,
+                                       const int endMCU);
+            
+            /// Decode the Huffman coded coefficients of one 8x8 block
+            ///
+            /// The quantized coefficients are written in natural order,
+            /// the IDCT de-quantizes them. The DC coefficient is
+            /// reconstructed from the DC prediction of the component.
+            ///
+            /// @param reader the bit reader over the image scan data
+            /// @param compID the index of the component the block belongs to (0 = Y, 1 = Cb, 2 = Cr)
+            /// @param DCPredictor the DC coefficient of the previous block of the component
+            /// @param block the block to write the coefficients to
+            /// @return true if the block was decoded, false if the scan data is corrupt
+            bool decodeBlock(BitReader& reader,
+                             const int compID,
+                             int& DCPredictor,
+                             CoefficientBlock& block) const;
+            
+            /// State of the entropy decoder at a block boundary
+            struct BlockBoundary
+            {
+                /// Position of the first bit of the block in the scan data
+                std::size_t bitPosition;
+                
+                /// Number of blocks decoded before this block
+                std::size_t blockCount;
+                
+                /// Index of the block in its MCU
+                int blockInMCU;
+            };
+            
+            /// Decode the scan data in chunks, in parallel, without restart markers
+            ///
+            /// @param MCUCount the number of MCUs in the image
+            /// @param threads the number of threads to use
+            /// @return true if the MCUs were decoded, false if the scan data is corrupt
+            bool decodeSpeculatively(const int MCUCount, const unsigned threads);
+            
+            /// Decode blocks, discarding the coefficients, up to the first block
+            /// boundary at or after the specified bit in the scan data
+            ///
+            /// Decoding stops early when a block boundary on the reference
+            /// path is reached: since the decoder is deterministic, the rest
+            /// of its path is then the same as the reference path.
+            ///
+            /// @param start the block boundary to start decoding from
+            /// @param endBit the bit in the scan data to decode up to
+            /// @param path if not null, the block boundaries passed are appended to it
+            /// @param reference if not null, the path to stop at
+            /// @param match set to the index of the block boundary reached on the reference path, -1 if none
+            /// @return the block boundary where decoding stopped
+            BlockBoundary skipBlocks(const BlockBoundary& start,
+                                     const std::size_t endBit,
+                                     std::vector<BlockBoundary>* path,
+                                     const std::vector<BlockBoundary>* reference,
+                                     int& match) const;
+        
         private:
             
             // void displayHuffmanCodes();
-            
+        
         private:
             
             std::string m_filename;
             
-            std::ifstream m_imageFile;
+            // The sources of JFIF data the decoder provides, a mapped file or a caller's buffer
+            MappedFileSource m_fileSource;
+            MemorySource m_memorySource;
+            
+            // The source the JFIF data is read from, nullptr if none is open
+            const ByteSource* m_source;
+            
+            // The reader over the JFIF data, at the next marker to parse
+            ByteReader m_reader;
             
             Image m_image;
             
+            // The quantization tables, in zig-zag order as stored in the DQT segments
             std::vector<std::vector<UInt16>> m_QTables;
             
+            // The quantization tables, prepared for the IDCT
+            std::array<DequantizationTable, 4> m_dequantizationTables;
+            
             // For i=0..3:
             //    HT_i is array of size=16, where j-th element is < count-j-bits, symbol-list >
             //
@@ -112,12 +540,90 @@ namespace kpeg
             
             // std::vector< std::pair<int, int> > mDHTsScanned;
             
-            HuffmanTree m_huffmanTree[2][2];
+            // The decoders for the Huffman tables, shared with other
+            // images using the same tables
+            std::shared_ptr<const HuffmanDecoder> m_huffmanDecoder[2][2];
+            
+            // Image scan data, the compressed bytes following the SOS segment
+            std::vector<UInt8> m_scanData;
+            
+            // Offsets in the scan data where the restart markers were found
+            std::vector<std::size_t> m_restartOffsets;
+            
+            // Number of MCUs in a restart interval, 0 if restart markers aren't used
+            UInt16 m_restartInterval;
+            
+            // Number of threads to decode with, 0 for one per core
+            unsigned m_threadCount;
+            
+            // Whether scans without restart markers are decoded speculatively in parallel
+            bool m_speculative;
             
-            // Image scan data
-            std::string m_scanData;
+            // Width and height of the image in the JFIF file, before scaling
+            UInt16 m_frameWidth;
+            UInt16 m_frameHeight;
             
+            // Denominator of the scale of the decoded image
+            unsigned m_scale;
+            
+            // The IDCT kernel used to construct the MCUs
+            IDCTKernel m_IDCTKernel;
+            
+            // The pixel format of the decoded image
+            PixelFormat m_pixelFormat;
+            
+            // Whether the pixel format was set, else it follows the image
+            bool m_pixelFormatSet;
+            
+            // How subsampled chrominance is upsampled
+            UpsamplingMode m_upsampling;
+            
+            // The components of the frame, in the order of the SOF segment
+            std::vector<Component> m_components;
+            
+            // The index of the component of each block in an MCU
+            std::vector<int> m_blockComponents;
+            
+            // The MCUs being decoded, a row of them, or all of them when decoding in parallel
             std::vector<MCU> m_MCU;
+            
+            // The coefficients of the components, when only decoding coefficients
+            std::array<ComponentCoefficients, 3> m_coefficients;
+            
+            // The scratch memory of the image being decoded, rewound between images
+            Arena m_arena;
+            
+            /// The stages of decoding fed data
+            enum FeedStage
+            {
+                FEED_SEGMENTS, // Parsing the segments
+                FEED_SCAN,     // Decoding the scan data
+                FEED_FINISHED  // Decoded, or stopped by an error
+            };
+            
+            // Whether the JFIF data is fed, and whether all of it has been
+            FeedStage m_feedStage;
+            bool m_fed;
+            bool m_feedEnded;
+            
+            // The result fed data finished with, once it has
+            ResultCode m_feedResult;
+            
+            // The fed data not parsed yet
+            std::vector<UInt8> m_feedData;
+            
+            // The restart markers in the latest fed scan data
+            std::vector<std::size_t> m_fedRestartOffsets;
+            
+            // The scan being decoded from fed data and the position of its entropy decoder
+            ScanLayout m_fedScan;
+            ScanPosition m_fedPosition;
+            bool m_fedScanStarted;
+            bool m_fedCorrupt;
+            
+            // The next MCU to decode from fed data, and the scan data size to try it again at
+            int m_nextFedMCU;
+            std::size_t m_fedRetrySize;
     };
 }
 
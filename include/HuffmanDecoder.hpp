@@ -0,0 +1,105 @@
+// Huffman decoder abstraction
+
+#ifndef HUFFMAN_DECODER_HPP
+#define HUFFMAN_DECODER_HPP
+
+#include <memory>
+#include <array>
+
+#include "Types.hpp"
+#include "BitReader.hpp"
+
+namespace kpeg
+{
+    /// Number of bits used to index the fast Huffman lookup table
+    ///
+    /// Codes of at most this length are decoded with a single table
+    /// lookup, longer codes fall back to the canonical MAXCODE/VALPTR
+    /// search described in ITU-T.81, section F.2.2.3
+    const int HUFF_LOOKUP_BITS = 9;
+
+    /// HuffmanDecoder is a flat, canonical representation of
+    /// a Huffman table, used for decoding the scan data.
+    ///
+    /// JPEG Huffman codes are canonical, so the codes never have to
+    /// be materialized as a tree: the table is fully described by
+    /// the largest code of each length and the position of the first
+    /// symbol of each length in the symbol list. These are generated
+    /// in a single pass over the Huffman table found in the JFIF file.
+    class HuffmanDecoder
+    {
+        public:
+
+            /// Default constructor
+            HuffmanDecoder();
+
+            /// Build the decoding tables for the specified Huffman table
+            ///
+            /// @param htable the Huffman table to use
+            /// @return true if the table is valid, false if its code counts overflow the code space
+            bool constructDecoder(const HuffmanTable& htable);
+
+            /// Decode the next Huffman coded symbol in the scan data
+            ///
+            /// @param reader the bit reader over the image scan data, advanced past the decoded code
+            /// @return the decoded symbol, or -1 if the bits don't form a valid code
+            int decodeSymbol(BitReader& reader) const;
+
+        private:
+
+            // Fast lookup table indexed by the next HUFF_LOOKUP_BITS bits,
+            // each entry is (code length << 8 | symbol), 0 if the code is longer
+            std::array<UInt16, 1 << HUFF_LOOKUP_BITS> m_lookup;
+
+            // Largest code of each length, -1 if there are no codes of that length
+            std::array<int, 17> m_maxCode;
+
+            // Difference between the index of the first symbol of each
+            // length in the symbol list and the smallest code of that length
+            std::array<int, 17> m_valOffset;
+
+            // The symbols, in increasing order of code length
+            std::array<UInt8, 256> m_symbols;
+    };
+
+    inline int HuffmanDecoder::decodeSymbol(BitReader& reader) const
+    {
+        UInt16 entry = m_lookup[reader.peekBits(HUFF_LOOKUP_BITS)];
+
+        if (entry != 0)
+        {
+            reader.consumeBits(entry >> 8);
+            return entry & 0xFF;
+        }
+
+        // The code is longer than HUFF_LOOKUP_BITS, extend it one bit at a time
+        std::uint32_t bits = reader.peekBits(16);
+
+        for (auto length = HUFF_LOOKUP_BITS + 1; length <= 16; ++length)
+        {
+            int code = int(bits >> (16 - length));
+
+            if (code <= m_maxCode[length])
+            {
+                reader.consumeBits(length);
+                return m_symbols[code + m_valOffset[length]];
+            }
+        }
+
+        return -1;
+    }
+
+    /// Get the Huffman decoder for the specified Huffman table
+    ///
+    /// Decoders are kept in a process-wide cache keyed by the table's
+    /// bytes in the DHT segment (the code counts and the symbols), so
+    /// images sharing their Huffman tables, e.g., images from the same
+    /// camera or the many images using the example tables of ITU-T.81
+    /// Annex K, reuse the decoders built for an earlier image.
+    ///
+    /// @param htable the Huffman table
+    /// @return the decoder for the table, nullptr if the table is invalid
+    std::shared_ptr<const HuffmanDecoder> getHuffmanDecoder(const HuffmanTable& htable);
+}
+
+#endif // HUFFMAN_DECODER_HPP
@@ -0,0 +1,150 @@
+/// Inverse discrete cosine transform module
+///
+/// Kernels for converting a block of de-quantized DCT coefficients
+/// back to 8x8 samples. Every kernel level shifts its output and
+/// clamps it to the sample range [0, 255].
+
+#ifndef IDCT_HPP
+#define IDCT_HPP
+
+#include <array>
+#include <vector>
+#include <cstddef>
+
+#include "Types.hpp"
+
+namespace kpeg
+{
+    /// Zig-zag index of the last coefficient in the top left 4x4 corner
+    /// of a block, blocks whose last non-zero coefficient is at or
+    /// before it take the top left IDCT kernels
+    const int IDCT_TOP_LEFT_LAST_ZIGZAG = 9;
+    
+    /// The available IDCT kernels
+    enum IDCTKernel
+    {
+        IDCT_AUTO,
+        IDCT_FLOAT_REFERENCE,
+        IDCT_INTEGER,
+        IDCT_SSE2,
+        IDCT_AVX2
+    };
+    
+    /// A quantization table, prepared for the IDCT kernels
+    ///
+    /// The kernels de-quantize the coefficients as they load them,
+    /// multiplying them by the factors for their kind of arithmetic.
+    struct alignas(16) DequantizationTable
+    {
+        /// Factors for the fixed-point kernels, the quantization table in natural order
+        std::array<int, 64> integerFactors;
+        
+        /// Factors for the floating point kernels, the quantization table in
+        /// natural order prescaled by 1/8, the normalization of the 2D IDCT
+        std::array<float, 64> floatFactors;
+    };
+    
+    /// Prepare a quantization table for the IDCT kernels
+    ///
+    /// @param QTable the quantization table, in zig-zag order as stored in the DQT segment
+    /// @param table the table to prepare
+    void prepareDequantizationTable(const std::vector<UInt16>& QTable, DequantizationTable& table);
+    
+    /// Signature of an IDCT kernel
+    ///
+    /// @param block the quantized coefficients, in natural order
+    /// @param table the quantization table of the block
+    /// @param output the first sample of the 8x8 output block
+    /// @param stride the distance in bytes between the rows of the output block
+    typedef void (*IDCTFunction)(const CoefficientBlock& block,
+                                 const DequantizationTable& table,
+                                 UInt8* output,
+                                 const std::size_t stride);
+    
+    /// Reference IDCT, a direct evaluation of the IDCT definition in floating point
+    ///
+    /// Every sample is computed as the full 2D sum over the 64 coefficients,
+    /// as given in ITU-T.81, section A.3.3. Slow, but accurate.
+    void idctFloatReference(const CoefficientBlock& block, const DequantizationTable& table, UInt8* output, const std::size_t stride);
+    
+    /// Separable fixed-point IDCT
+    ///
+    /// A 1D IDCT is applied to the columns, then to the rows, using the
+    /// Loeffler-Ligtenberg-Moschytz factorization (12 multiplications
+    /// per 1D IDCT) with 13-bit fixed-point constants. Columns whose AC
+    /// coefficients are all zero are handled as a special case.
+    void idctInteger(const CoefficientBlock& block, const DequantizationTable& table, UInt8* output, const std::size_t stride);
+    
+    /// Fixed-point IDCT of a block with non-zero coefficients only in its top left 4x4 corner
+    void idctIntegerTopLeft(const CoefficientBlock& block, const DequantizationTable& table, UInt8* output, const std::size_t stride);
+    
+    /// SSE2 IDCT, the LLM factorization in floating point, four columns at a time
+    ///
+    /// Only available on x86 builds.
+    void idctSSE2(const CoefficientBlock& block, const DequantizationTable& table, UInt8* output, const std::size_t stride);
+    
+    /// SSE2 IDCT of a block with non-zero coefficients only in its top left 4x4 corner
+    void idctSSE2TopLeft(const CoefficientBlock& block, const DequantizationTable& table, UInt8* output, const std::size_t stride);
+    
+    /// AVX2 IDCT, the LLM factorization in floating point, a whole block row at a time
+    ///
+    /// Only available on x86 builds, and must only be called on CPUs supporting AVX2.
+    void idctAVX2(const CoefficientBlock& block, const DequantizationTable& table, UInt8* output, const std::size_t stride);
+    
+    /// AVX2 IDCT of a block with non-zero coefficients only in its top left 4x4 corner
+    void idctAVX2TopLeft(const CoefficientBlock& block, const DequantizationTable& table, UInt8* output, const std::size_t stride);
+    
+    /// IDCT of a block with only a DC coefficient, a flat fill
+    void idctDCOnly(const CoefficientBlock& block, const DequantizationTable& table, UInt8* output, const std::size_t stride);
+    
+    /// Scaled IDCT, 4x4 samples from the top left 4x4 coefficients, for decoding at 1/2 scale
+    ///
+    /// The scaled IDCTs output the samples the full IDCT gives at the
+    /// center of each group of samples, for the cost of a smaller
+    /// transform. They're fixed-point, whatever the selected kernel.
+    void idctScaled4x4(const CoefficientBlock& block, const DequantizationTable& table, UInt8* output, const std::size_t stride);
+    
+    /// Scaled IDCT, 2x2 samples from the top left 2x2 coefficients, for decoding at 1/4 scale
+    void idctScaled2x2(const CoefficientBlock& block, const DequantizationTable& table, UInt8* output, const std::size_t stride);
+    
+    /// Scaled IDCT, the single sample DC / 8, for decoding at 1/8 scale
+    void idctScaled1x1(const CoefficientBlock& block, const DequantizationTable& table, UInt8* output, const std::size_t stride);
+    
+    /// Get the name of a kernel, as used in the KPEG_IDCT environment variable
+    ///
+    /// @param kernel the kernel
+    /// @return the name of the kernel
+    const char* getIDCTKernelName(const IDCTKernel kernel);
+    
+    /// Check whether a kernel can be used on this build and CPU
+    ///
+    /// @param kernel the kernel
+    /// @return true if the kernel can be used
+    bool isIDCTKernelSupported(const IDCTKernel kernel);
+    
+    /// Get the kernel IDCT_AUTO stands for
+    ///
+    /// The kernel can be forced with the KPEG_IDCT environment variable,
+    /// set to one of float, integer, sse2 or avx2. Otherwise the fastest
+    /// kernel the CPU supports is picked, the CPU is checked at runtime.
+    ///
+    /// @return the kernel to use
+    IDCTKernel getDefaultIDCTKernel();
+    
+    /// Get the IDCT function implementing the specified kernel
+    ///
+    /// Except for the reference IDCT, the function looks at the last
+    /// non-zero coefficient of each block to use the flat fill for
+    /// DC-only blocks and the top left kernel where it applies.
+    ///
+    /// Falls back to the integer IDCT if the kernel isn't supported.
+    /// For scaled decoding (size below 8) the scaled IDCT of that size
+    /// is returned, regardless of the kernel.
+    ///
+    /// @param kernel the kernel
+    /// @param size the number of samples per block row and column output: 8, 4, 2 or 1
+    /// @return the function implementing the kernel
+    IDCTFunction getIDCTFunction(const IDCTKernel kernel, const int size = 8);
+}
+
+#endif // IDCT_HPP
@@ -1,24 +1,79 @@
 /// Image module
 ///
 /// Abstraction representing a raw uncompressed image
+///
+/// The image is stored in the pixel format requested from the decoder,
+/// either as a single plane of packed pixels or as separate Y, Cb and
+/// Cr planes, all in one 64-byte aligned allocation. The rows of each
+/// plane are stored one after another, a multiple of 64 bytes apart, so
+/// every row starts aligned for SIMD kernels.
+///
+/// The planes cover the whole grid of MCUs, the rows and columns of the
+/// MCUs on the right and bottom edges that lie outside the image are
+/// decoded too, but hidden behind the image's width and height.
+///
+/// The image can also be decoded straight into a buffer owned by the
+/// caller, with the caller's stride and only the image's own pixels.
 
 #ifndef IMAGE_HPP
 #define IMAGE_HPP
 
 #include <iostream>
-#include <fstream>
 #include <vector>
 #include <array>
 #include <memory>
 
 #include "Types.hpp"
 #include "MCU.hpp"
+#include "ColorConversion.hpp"
+#include "Utility.hpp"
 
 namespace kpeg
-{    
+{
+    /// Get the name of the specified pixel format
+    ///
+    /// @param format the pixel format
+    /// @return the name of the format, e.g., "rgb8" or "i420"
+    const char* getPixelFormatName(const PixelFormat format);
+    
+    /// Get the number of planes of the specified pixel format
+    ///
+    /// @param format the pixel format
+    /// @return 3 for the planar formats, else 1
+    int getPlaneCount(const PixelFormat format);
+    
+    /// Get the number of bytes per pixel in the planes of the specified pixel format
+    ///
+    /// @param format the pixel format
+    /// @return the size of a pixel, 1 for the grayscale and planar formats
+    int getBytesPerPixel(const PixelFormat format);
+    
+    /// Get the extension of the files the raw data of the specified pixel format is dumped to
+    ///
+    /// @param format the pixel format
+    /// @return ".ppm" for RGB formats, ".pam" for RGBA formats, ".pgm" for grayscale and ".yuv" for planar formats
+    const char* getRawFileExtension(const PixelFormat format);
+    
+    /// Get the size of a caller's buffer holding an image
+    ///
+    /// The planes of planar formats follow each other, the chrominance
+    /// planes of I420 images have half the stride of the luminance plane,
+    /// rounded up.
+    ///
+    /// @param format the pixel format
+    /// @param width the width of the image
+    /// @param height the height of the image
+    /// @param stride the number of bytes between the rows of the first plane, 0 for rows without padding
+    /// @return the size of the buffer in bytes, 0 if the stride is too small for the rows
+    std::size_t getImageBufferSize(const PixelFormat format,
+                                   const std::size_t width,
+                                   const std::size_t height,
+                                   const std::size_t stride = 0);
+    
     /// Image is an abstraction for a raw, uncompressed image
     ///
-    /// A raw, uncompressed image is nothing but a 2D array of pixels
+    /// A raw, uncompressed image is nothing but a 2D array of pixels,
+    /// or three of them for planar pixel formats
     class Image
     {
         public:
@@ -26,30 +81,211 @@ namespace kpeg
             /// Default constructor
             Image();
             
+            /// Empty the image, keeping its buffers for the next image started
+            void clear();
+            
             /// Create an image from a list of MCUs
             ///
+            /// The MCUs are laid out in rows, left to right and top to bottom,
+            /// the MCUs on the right and bottom edges may extend past the image.
+            ///
+            /// The luminance must have the largest sampling factors, the
+            /// chrominance components the same ones, at most halving
+            /// the luminance resolution in each direction. Grayscale
+            /// images only have the luminance, with neutral chrominance.
+            ///
             /// @param MCUs list of minimum coded units that can be converted to an image
-            void createImageFromMCUs(const std::vector<MCU>& MCUs);
+            /// @param components the Y, Cb and Cr components, or only Y, whose blocks make up the MCUs
+            /// @param blockSize the number of samples per block row and column, below 8 for scaled decoding
+            /// @param format the pixel format to store the image in
+            /// @param upsampling how subsampled chrominance is upsampled
+            void createImageFromMCUs(const std::vector<MCU>& MCUs,
+                                     const std::vector<Component>& components,
+                                     const int blockSize = 8,
+                                     const PixelFormat format = PIXEL_FORMAT_RGB8,
+                                     const UpsamplingMode upsampling = UPSAMPLING_FANCY);
+            
+            /// Start creating the image from rows of MCUs
+            ///
+            /// The image is created a row of MCUs at a time, as the rows are
+            /// added, so only the MCUs of one row need to exist at a time.
+            /// The same constraints as for createImageFromMCUs apply.
+            ///
+            /// @param components the Y, Cb and Cr components, or only Y, whose blocks make up the MCUs
+            /// @param blockSize the number of samples per block row and column, below 8 for scaled decoding
+            /// @param format the pixel format to store the image in
+            /// @param upsampling how subsampled chrominance is upsampled
+            /// @param buffer the caller's buffer to store the image in, laid out as described by getImageBufferSize, nullptr for the image to allocate its own
+            /// @param stride the number of bytes between the rows of the first plane of the caller's buffer, 0 for rows without padding
+            void startImage(const std::vector<Component>& components,
+                            const int blockSize = 8,
+                            const PixelFormat format = PIXEL_FORMAT_RGB8,
+                            const UpsamplingMode upsampling = UPSAMPLING_FANCY,
+                            UInt8* buffer = nullptr,
+                            const std::size_t stride = 0);
+            
+            /// Add the next row of MCUs to the image started with startImage
+            ///
+            /// The samples of the MCUs are copied out, the MCUs may be reused
+            /// for the next row once this returns. Vertical upsampling needs
+            /// the first row of samples of the next row of MCUs, so the pixels
+            /// of a row of MCUs are output when the next row is added, those
+            /// of the last row right away.
+            ///
+            /// @param MCUs the MCUs of the row, left to right
+            void addMCURow(const MCU* MCUs);
             
             /// Write the raw, uncompressed image data to specified file on the disk.
             ///
-            /// The data written is in PPM format
+            /// RGB images are written in PPM format, RGBA images in PAM
+            /// format, grayscale images in PGM format and planar images as
+            /// their raw planes, one after another. See ImageWriter.
             ///
             /// @param filename the location in the disk to write the image data
             /// @return true if succeeds in writing, else false
             const bool dumpRawData(const std::string& filename);
             
+            /// Get the pixel format of the image
+            ///
+            /// @return the pixel format
+            PixelFormat getPixelFormat() const;
+            
+            /// Get the pixels of a plane of the image
+            ///
+            /// Packed formats have a single plane, planar formats have
+            /// the Y, Cb and Cr planes, in that order.
+            ///
+            /// @param plane the index of the plane
+            /// @return the first row of the plane, nullptr if the image is empty
+            const UInt8* getPlane(const int plane = 0) const;
+            
+            /// Get the number of bytes between the rows of a plane
+            ///
+            /// The stride of the image's own planes is a multiple of
+            /// ROW_ALIGNMENT, and may be larger than the bytes of the
+            /// row's pixels.
+            ///
+            /// @param plane the index of the plane
+            /// @return the stride of the plane
+            std::size_t getStride(const int plane = 0) const;
+            
+            /// Get the width of a plane, in pixels
+            ///
+            /// @param plane the index of the plane
+            /// @return the width of the plane
+            std::size_t getPlaneWidth(const int plane = 0) const;
+            
+            /// Get the height of a plane, in pixels
+            ///
+            /// @param plane the index of the plane
+            /// @return the height of the plane
+            std::size_t getPlaneHeight(const int plane = 0) const;
+            
+            /// Get the number of rows of pixels output so far
+            ///
+            /// While the image is created a row of MCUs at a time, its top
+            /// rows are final before the rest are. Subsampled planes have
+            /// their rows for the completed rows of the first plane, e.g.,
+            /// half as many for I420.
+            ///
+            /// @return the number of rows at the top of the image that are complete
+            std::size_t getCompletedRowCount() const;
+        
         public:
             
+            /// The alignment of the pixels and of the rows of the planes, in bytes
+            static const std::size_t ROW_ALIGNMENT = 64;
+            
             /// Width of the image
             std::size_t width;
-
+            
             /// Height of the image
             std::size_t height;
-
+        
+        private:
+            
+            /// Get the pixels of a plane of the image, for writing
+            ///
+            /// @param plane the index of the plane
+            /// @return the first row of the plane
+            UInt8* getPlaneData(const int plane);
+            
+            /// Convert a row of MCUs to pixels
+            ///
+            /// @param MCURow the index of the row of MCUs
+            void outputMCURow(const std::size_t MCURow);
+            
+            /// Get a buffered row of samples of a component
+            ///
+            /// @param component the index of the component
+            /// @param MCURow the index of the row of MCUs
+            /// @param row the row of samples in the row of MCUs, -1 and the row past the last being the context rows
+            /// @return the first sample of the row, with a sample of padding on either side
+            UInt8* getComponentRow(const int component, const std::size_t MCURow, const int row);
+            
+            /// Get the width of a plane, including the MCU padding
+            ///
+            /// @param plane the index of the plane
+            /// @return the padded width of the plane
+            std::size_t getPaddedPlaneWidth(const int plane) const;
+            
+            /// Get the height of a plane, including the MCU padding
+            ///
+            /// @param plane the index of the plane
+            /// @return the padded height of the plane
+            std::size_t getPaddedPlaneHeight(const int plane) const;
+        
         private:
-            /// The 2D pixel array with discrete range
-            PixelPtr m_pixelPtr;
+            
+            /// The pixel format of the image
+            PixelFormat m_format;
+            
+            /// The size of the image padded to the grid of MCUs
+            std::size_t m_paddedWidth;
+            std::size_t m_paddedHeight;
+            
+            /// The pixels of all the planes, unless they're in a caller's buffer
+            std::vector<UInt8, utils::AlignedAllocator<UInt8, ROW_ALIGNMENT>> m_pixels;
+            
+            /// The caller's buffer holding the planes, nullptr if the image holds them
+            UInt8* m_buffer;
+            
+            /// The offsets of the planes in the pixels and the strides of the planes
+            std::size_t m_planeOffsets[3];
+            std::size_t m_strides[3];
+            
+            /// The components whose blocks make up the MCUs being added
+            std::vector<Component> m_components;
+            
+            /// The number of samples per block row and column
+            int m_blockSize;
+            
+            /// The subsampling of the chrominance, horizontally and vertically
+            int m_hFactor;
+            int m_vFactor;
+            
+            /// How subsampled chrominance is upsampled
+            UpsamplingMode m_upsampling;
+            
+            /// The kernel converting rows to packed RGB formats
+            ColorConversionFunction m_convert;
+            
+            /// The number of MCUs in a row, the number of rows and the rows added so far
+            std::size_t m_MCUsPerRow;
+            std::size_t m_MCURows;
+            std::size_t m_MCURowsAdded;
+            
+            /// The buffered rows of samples of each component, their stride
+            /// and the number of rows per row of MCUs
+            std::vector<UInt8> m_componentRows[3];
+            std::size_t m_componentStrides[3];
+            int m_componentHeights[3];
+            
+            /// A row of neutral chrominance, for grayscale images
+            std::vector<UInt8> m_neutralChroma;
+            
+            /// The chrominance of the last even row, for halving the chrominance of I420 images
+            std::vector<UInt8> m_evenChromaRows[2];
     };
 }
 
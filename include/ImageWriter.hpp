@@ -0,0 +1,111 @@
+/// Image writer module
+///
+/// Writes decoded images to files: PGM (P5) for grayscale images, PPM
+/// (P6) for RGB images, PAM (P7) for RGBA images, keeping their alpha
+/// channel, and the raw planes of planar images, one after another.
+///
+/// The header is built once and goes out with the first rows. The rows
+/// are handed straight to the file with writev, an I/O vector entry per
+/// row, or a single entry when the rows are contiguous, so the pixels
+/// aren't copied through stream buffers. Only BGR images are copied,
+/// a batch of rows at a time, to put their channels in RGB order.
+
+#ifndef IMAGE_WRITER_HPP
+#define IMAGE_WRITER_HPP
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+#include <sys/uio.h>
+
+#include "Types.hpp"
+
+namespace kpeg
+{
+    /// Writer of the rows of an image to a file
+    ///
+    /// The rows may be written all at once, or a few at a time as they're
+    /// decoded, e.g., the completed rows of an image decoded from fed data.
+    class ImageWriter
+    {
+        public:
+            
+            /// Default constructor, no file open
+            ImageWriter();
+            
+            /// Destructor, closes the file
+            ~ImageWriter();
+            
+            ImageWriter(const ImageWriter&) = delete;
+            ImageWriter& operator=(const ImageWriter&) = delete;
+            
+            /// Create the file for an image, closing the previous one
+            ///
+            /// @param filename the path of the file
+            /// @param format the pixel format of the rows written
+            /// @param width the width of the image
+            /// @param height the height of the image
+            /// @return true if the file was created, else false
+            bool open(const std::string& filename,
+                      const PixelFormat format,
+                      const std::size_t width,
+                      const std::size_t height);
+            
+            /// Write the next rows of a plane
+            ///
+            /// Planar images are written plane by plane, all the rows of
+            /// a plane before those of the next.
+            ///
+            /// @param rows the first row to write
+            /// @param stride the number of bytes between the rows
+            /// @param count the number of rows to write
+            /// @param plane the index of the plane the rows belong to
+            /// @return true if the rows were written, else false
+            bool writeRows(const UInt8* rows,
+                           const std::size_t stride,
+                           const std::size_t count,
+                           const int plane = 0);
+            
+            /// Close the file
+            ///
+            /// @return true if the whole file was written, else false
+            bool close();
+        
+        private:
+            
+            /// Write the pending I/O vector entries, all of them
+            ///
+            /// @return true if everything was written, else false
+            bool flush();
+            
+            /// Add an I/O vector entry, flushing the entries first if they're full
+            ///
+            /// @param data the bytes to write
+            /// @param size the number of bytes
+            void append(const void* data, const std::size_t size);
+        
+        private:
+            
+            // The file descriptor of the file, -1 if none is open
+            int m_file;
+            
+            // The pixel format and width of the image
+            PixelFormat m_format;
+            std::size_t m_width;
+            
+            // The header, written with the first rows
+            std::string m_header;
+            
+            // The pending I/O vector entries, the header is the first one
+            std::vector<struct iovec> m_entries;
+            
+            // The rows of BGR images, with their channels in RGB order
+            std::vector<UInt8> m_swapped;
+            
+            // Whether any write failed
+            bool m_failed;
+    };
+}
+
+#endif // IMAGE_WRITER_HPP
@@ -1,12 +1,18 @@
 /// Minimum Coded Unit (MCU) module
 ///
-/// Represents an abstraction for a MCU. An MCU is a block of 8x8 pixels.
-/// This abstracts away the conversion of the decoded RLE-Huffman encoded pixel values
-/// to corresponding matrices of 8x8 size. It actually contains three 8x8 matrices to
-/// represent the lumninance (Y) and chrominance (Cb & Cr) components.
+/// Represents an abstraction for a MCU. An MCU is the smallest group of 8x8
+/// blocks covering the same area of the image in all components: a single
+/// block per component without chroma subsampling, or several luminance
+/// (Y) blocks followed by one block of each chrominance (Cb & Cr) component
+/// with it, e.g., 4 Y blocks for 4:2:0 subsampling.
 /// 
-/// The MCU object expects as input the RLE-Huffman encoded vector (obtained after
-/// the Huffman decoding is done).
+/// The entropy decoder writes the quantized coefficients of each component
+/// straight into the MCU's coefficient blocks, in natural order. The samples
+/// the MCU outputs are converted to RGB a whole image row at a time, by the
+/// image.
+///
+/// The blocks of an MCU are allocated from the decoder's arena, MCUs only
+/// refer to them, so they are valid until the arena is rewound.
 
 #ifndef MCU_HPP
 #define MCU_HPP
@@ -17,79 +23,71 @@
 
 #include "Types.hpp"
 #include "Transform.hpp"
+#include "IDCT.hpp"
+#include "Arena.hpp"
 
 namespace kpeg
 {
-    /// Alias for a 8x8 pixel block with integral values for its channels
-    typedef std::array<std::array<std::array<int, 8>, 8>, 3> CompMatrices;
-    
-    /// Alias for a 8x8 matrix with integral elements
-    typedef std::array< std::array< int, 8 >, 8 > Matrix8x8;
+    /// Alias for the 8x8 samples of a component, in row-major order
+    typedef std::array<UInt8, 64> SampleBlock;
     
     class MCU
     {
         public:
             
-            /// The total number of MCUs in the image
-            static int m_MCUCount;
-            
-            /// The quantization table used for de-quantization
-            static std::vector<std::vector<UInt16>> m_QTables;
-
-        public:
-            
-            /// Default constructor
-            MCU();
+            /// Constructor
+            ///
+            /// The coefficients of the blocks start out zero.
+            ///
+            /// @param blockCount the number of blocks in the MCU
+            /// @param arena the arena to allocate the blocks from
+            MCU(const int blockCount, Arena& arena);
             
-            /// Parameterized constructor
+            /// Get the specified coefficient block
             ///
-            /// Initialze the MCU with run-length encoding per
-            /// channel and the quantization tables to use
+            /// The entropy decoder fills in the block before the MCU is constructed
             ///
-            /// @param compRLE the run-length encoding for the MCU
-            /// @param QTables the quantization tables to be used for encoding the MCU
-            MCU(const std::array<std::vector<int>, 3>& compRLE,
-                const std::vector<std::vector<UInt16>>& QTables);
+            /// @param blockID the index of the block in the MCU
+            /// @return the coefficient block
+            CoefficientBlock& getCoefficients(const int blockID);
             
-            /// Create the MCU from the specified run-length encoding and quantization tables
+            /// Create the MCU from the coefficient blocks written by the entropy decoder
             ///
-            /// @param compRLE the run-length encoding for the MCU
-            /// @param QTables the quantization tables to be used for encoding the MCU
-            void constructMCU(const std::array<std::vector<int>, 3>& compRLE,
-                              const std::vector<std::vector<UInt16>>& QTables);
+            /// @param idct the IDCT kernel used to convert the coefficients to samples
+            /// @param tables the quantization table of each block
+            void constructMCU(IDCTFunction idct, const DequantizationTable* const* tables);
             
-            /// Get the pixel arrays for the pixels under this MCU.
+            /// Get the samples of the specified block
             ///
-            /// Since there are three channels per MCU, three pixel arrays will be returned.
-            const CompMatrices& getAllMatrices() const;
+            /// The rows of the samples are 8 bytes apart. With scaled decoding
+            /// only their top left corner is used.
+            ///
+            /// @param blockID the index of the block in the MCU
+            /// @return the samples of the block
+            const SampleBlock& getSamples(const int blockID) const;
         
         private:
             
             /// Inverse discrete cosine transform
             ///
-            /// The 8x8 matrices for each component has to be converted
-            /// back from frequency to spaital domain.
-            void computeIDCT();
-            
-            /// Level shift the pixel data to center it within the pixel value range
-            void performLevelShift();
-            
-            /// Convert the MCU's underlying pixels from the Y-Cb-Cr color model to RGB color model
-            void convertYCbCrToRGB();
-            
+            /// The 8x8 matrices for each block has to be converted
+            /// back from frequency to spaital domain. The kernel also
+            /// level shifts the samples back to the range [0, 255].
+            ///
+            /// @param idct the IDCT kernel to use
+            /// @param tables the quantization table of each block
+            void computeIDCT(IDCTFunction idct, const DequantizationTable* const* tables);
+        
         private:
             
-            /// The pixel arrays for the three channels in the MCU
-            CompMatrices m_block;
-
-            /// The order of the MCU in the image
-            int m_order;
+            /// The number of blocks in the MCU
+            int m_blockCount;
             
-            /// The differences in the DC coefficients per channel
-            static int m_DCDiff[3];
+            /// The quantized DCT coefficients of the blocks
+            CoefficientBlock* m_coeffs;
             
-            // For storing the IDCT coefficients before level shifting
-            std::array<std::array<std::array<float, 8>, 8>, 3> m_IDCTCoeffs;
+            // The level shifted samples of the blocks, output by the IDCT
+            SampleBlock* m_samples;
     };
 }
 
@@ -15,6 +15,7 @@ namespace kpeg
     ///
     /// Refer to ITU-T.81 (09/92), page 32
     const UInt16 JFIF_BYTE_FF    = 0xFF; // All markers start with this as the MSB                  
+    const UInt16 JFIF_TEM        = 0x01; // Temporary marker for arithmetic coding, no segment
     const UInt16 JFIF_SOF0       = 0xC0; // Start of Frame 0, Baseline DCT                           
     const UInt16 JFIF_SOF1       = 0xC1; // Start of Frame 1, Extended Sequential DCT               
     const UInt16 JFIF_SOF2       = 0xC2; // Start of Frame 2, Progressive DCT                       
@@ -29,10 +30,13 @@ namespace kpeg
     const UInt16 JFIF_SOF13      = 0xCD; // Differential Sequential DCT, Arithmetic Coding          
     const UInt16 JFIF_SOF14      = 0xCE; // Differential Progressive DCT, Arithmetic Coding         
     const UInt16 JFIF_SOF15      = 0xCF; // Differential Lossless (Sequential), Arithmetic Coding   
+    const UInt16 JFIF_RST0       = 0xD0; // Restart marker 0, restart markers cycle through RST0-RST7
+    const UInt16 JFIF_RST7       = 0xD7; // Restart marker 7
     const UInt16 JFIF_SOI        = 0xD8; // Start of Image                                          
     const UInt16 JFIF_EOI        = 0xD9; // End of Image                                            
     const UInt16 JFIF_SOS        = 0xDA; // Start of Scan                                           
     const UInt16 JFIF_DQT        = 0xDB; // Define Quantization Table
+    const UInt16 JFIF_DRI        = 0xDD; // Define Restart Interval
     const UInt16 JFIF_APP0       = 0xE0; // Application Segment 0, JPEG-JFIF Image
     const UInt16 JFIF_COM        = 0xFE; // Comment
 }
@@ -0,0 +1,53 @@
+/// Scan data module
+///
+/// Helpers for preparing the entropy coded scan data for decoding
+
+#ifndef SCAN_DATA_HPP
+#define SCAN_DATA_HPP
+
+#include <vector>
+
+#include "Types.hpp"
+
+namespace kpeg
+{
+    /// The result of preparing the scan data
+    struct ScanDataInfo
+    {
+        /// Size of the scan data once stuffed bytes and restart markers are removed
+        std::size_t size;
+        
+        /// Offset in the input of the marker that ended the scan data,
+        /// the size of the input if no such marker was found
+        std::size_t markerOffset;
+    };
+    
+    /// Find the first 0xFF byte in a buffer
+    ///
+    /// Uses SSE2 to test 16 bytes at a time where available
+    ///
+    /// @param begin the start of the buffer
+    /// @param end the end of the buffer
+    /// @return pointer to the first 0xFF byte, end if there is none
+    const UInt8* findMarkerByte(const UInt8* begin, const UInt8* end);
+    
+    /// Remove stuffed bytes and restart markers from the scan data
+    ///
+    /// The scan data stores 0xFF bytes as 0xFF00, and restart markers
+    /// split it into restart intervals. The scan data ends at the first
+    /// other marker (normally EOI). This takes a single pass over the
+    /// data, copying the runs between 0xFF bytes to the output, so the
+    /// compressed data is copied out of the source and unstuffed at once.
+    ///
+    /// @param data the scan data, followed by the rest of the file
+    /// @param size the size of the data
+    /// @param output the unstuffed scan data, at most size bytes, may be data itself
+    /// @param restartOffsets set to the offsets in the unstuffed scan data where the restart markers were found
+    /// @return the size of the unstuffed scan data and where it ended in the input
+    ScanDataInfo unstuffScanData(const UInt8* data,
+                                 const std::size_t size,
+                                 UInt8* output,
+                                 std::vector<std::size_t>& restartOffsets);
+}
+
+#endif // SCAN_DATA_HPP
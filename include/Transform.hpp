@@ -10,6 +10,19 @@
 
 namespace kpeg
 {
+    /// Natural (row-major) order index of each zig-zag order index
+    const int ZIGZAG_TO_NATURAL[64] =
+    {
+         0,  1,  8, 16,  9,  2,  3, 10,
+        17, 24, 32, 25, 18, 11,  4,  5,
+        12, 19, 26, 33, 40, 48, 41, 34,
+        27, 20, 13,  6,  7, 14, 21, 28,
+        35, 42, 49, 56, 57, 50, 43, 36,
+        29, 22, 15, 23, 30, 37, 44, 51,
+        58, 59, 52, 45, 38, 31, 39, 46,
+        53, 60, 61, 54, 47, 55, 62, 63
+    };
+    
     /// Convert a zig-zag order index to its corresponding matrix indices
     ///
     /// @param zzIndex the index in the zig-zag order
@@ -22,12 +35,6 @@ namespace kpeg
     /// @return the zig-zag index corresponding to the matrix indices
     const int matIndicesToZZOrder(const int row, const int column);
 
-    /// Convert a bit strig to it's corresponding value
-    ///
-    /// @param bitStr the bit string
-    /// @return the value corresponding to the bit string
-    const Int16 bitStringtoValue(const std::string& bitStr);
-    
     /// Get the category of a value
     ///
     /// @param value the whose category has to be determined
@@ -9,6 +9,7 @@
 #include <array>
 #include <utility>
 #include <memory>
+#include <cstddef>
 
 namespace kpeg
 {
@@ -17,7 +18,7 @@ namespace kpeg
     /// The channels we deal with here are Red, Green and Blue channels
     /// in the RGB color model  and the Y, Cb and Cr channels in the
     /// Y-Cb-Cr color model.
-
+    
     /// Standard unsigned integral types
     typedef unsigned char  UInt8;
     typedef unsigned short UInt16;
@@ -34,46 +35,89 @@ namespace kpeg
         BLUE
     };
     
-    /// Pixel types
+    /// Pixel formats of the decoded image
+    ///
+    /// The packed formats store the channels of each pixel next to each
+    /// other, 8 bits per channel, with a constant (opaque) alpha channel
+    /// in the 4 channel formats. The planar formats store the Y, Cb and
+    /// Cr samples of the image in three separate planes, skipping color
+    /// conversion altogether.
+    enum PixelFormat
+    {
+        PIXEL_FORMAT_RGB8  , // R, G, B
+        PIXEL_FORMAT_BGR8  , // B, G, R
+        PIXEL_FORMAT_RGBA8 , // R, G, B, A
+        PIXEL_FORMAT_BGRA8 , // B, G, R, A
+        PIXEL_FORMAT_GRAY8 , // Y only
+        PIXEL_FORMAT_I420  , // Planar Y, Cb, Cr, chrominance halved in both directions
+        PIXEL_FORMAT_I444    // Planar Y, Cb, Cr, all at full resolution
+    };
+    
+    /// Coefficient block
     ///
-    /// These types are an abstraction of dealing with raw
-    /// image data in terms of the individual pixel level
+    /// The quantized DCT coefficients of an 8x8 block, stored in
+    /// natural (row-major) order as written by the entropy decoder.
+    /// The IDCT de-quantizes them.
+    struct alignas(16) CoefficientBlock
+    {
+        /// The coefficients, in row-major order
+        std::array<Int16, 64> coeffs;
+        
+        /// Zig-zag index of the last decoded non-zero coefficient,
+        /// 0 if only the DC coefficient may be non-zero
+        int lastNonZero;
+    };
+    
+    /// Quantized DCT coefficients of a component
     ///
-    /// The pixel types used here use three channels
-    /// (or components)
+    /// The blocks cover whole MCUs, in row-major order, so the blocks
+    /// past the right and bottom edges of the component are padding.
+    /// Each block is 64 contiguous coefficients in natural (row-major)
+    /// order, the quantization table is in the same order.
+    struct ComponentCoefficients
+    {
+        /// Number of blocks across and down the samples of the component
+        std::size_t widthInBlocks;
+        std::size_t heightInBlocks;
+        
+        /// Number of blocks across and down the stored blocks
+        std::size_t blocksPerRow;
+        std::size_t blockRows;
+        
+        /// The quantization table of the component
+        std::array<UInt16, 64> quantizationTable;
+        
+        /// The coefficients of the blocks, 64 per block
+        std::vector<Int16> coeffs;
+    };
     
-    /// Pixel with integral (discrete) channel range
-    struct Pixel
+    /// Color component of a frame
+    ///
+    /// Describes a component as specified by the SOF segment and the
+    /// Huffman tables the SOS segment selects for it, along with where
+    /// its blocks are in each MCU.
+    struct Component
     {
-        /// Default constructor
-        ///
-        /// By default a pixel is initialized to its lowest brightness value
-        Pixel()
-        {
-            comp[0] = comp[1] = comp[2]  = 0;
-        }
+        /// Identifier of the component, used by the SOS segment
+        UInt8 ID;
+        
+        /// Horizontal and vertical sampling factors, the number of
+        /// blocks of the component across and down an MCU
+        int horizontalSampling;
+        int verticalSampling;
+        
+        /// The quantization table of the component
+        int QTableID;
         
-        /// Parameterized constructor
-        ///
-        /// @param comp1 - Intensity value of pixel component 1
-        /// @param comp2 - Intensity value of pixel component 2
-        /// @param comp3 - Intensity value of pixel component 3
-        Pixel(const Int16 comp1, const Int16 comp2, const Int16 comp3)
-        {
-            comp[0] = comp1;
-            comp[1] = comp2;
-            comp[2] = comp3;
-        }
+        /// The Huffman tables of the component
+        int DCTableID;
+        int ACTableID;
         
-        /// Store the intensity of the pixel
-        Int16 comp[3];
+        /// Index of the first block of the component in an MCU, the
+        /// blocks of a component are in row-major order
+        int firstBlock;
     };
     
-    /// Aliases for commonly used types
-
-    /// A 2D array of pixels with integral (discrete) components
-    typedef std::shared_ptr<std::vector<std::vector<Pixel>>>  PixelPtr;
-
     /// Huffman table
     typedef std::array<std::pair<int, std::vector<UInt8>>, 16> HuffmanTable;
     
@@ -4,13 +4,15 @@
 #define UTILITY_HPP
 
 #include <string>
+#include <cstdlib>
 #include <cctype>
+#include <new>
 #include <fstream>
-
-// Output log file, ugly solution global for logging
-// into files! This approach is not recommended, I
-// used here to focus on JPEG, not logging! :p
-extern std::ofstream logFile;
+#include <ostream>
+#include <streambuf>
+#include <atomic>
+#include <thread>
+#include <vector>
 
 namespace kpeg
 {
@@ -73,7 +75,198 @@ namespace kpeg
                     return false;
             return true;
         }
+        
+        /// CPU helpers
+        
+        /// Check whether the CPU supports AVX2
+        ///
+        /// The AVX2 kernels are only built on x86-64, with GCC or Clang.
+        ///
+        /// @return true if the AVX2 kernels can be used, else false
+        inline bool isAVX2Supported()
+        {
+#if defined(KPEG_ENABLE_AVX2)
+            return __builtin_cpu_supports("avx2");
+#else
+            return false;
+#endif
+        }
+        
+        /// Memory helpers
+        
+        /// Round a size up to a multiple of an alignment
+        ///
+        /// @param size the size to round up
+        /// @param alignment the alignment, a power of two
+        /// @return the smallest multiple of the alignment not below the size
+        inline std::size_t alignSize(const std::size_t size, const std::size_t alignment)
+        {
+            return (size + alignment - 1) & ~(alignment - 1);
+        }
+        
+        /// Allocator of memory aligned to the specified boundary
+        ///
+        /// The default alignment of 64 bytes is a cache line, and enough
+        /// for aligned loads and stores of any SIMD kernel.
+        template <typename T, std::size_t ALIGNMENT = 64>
+        struct AlignedAllocator
+        {
+            typedef T value_type;
+            
+            template <typename U>
+            struct rebind
+            {
+                typedef AlignedAllocator<U, ALIGNMENT> other;
+            };
+            
+            AlignedAllocator() = default;
+            
+            template <typename U>
+            AlignedAllocator(const AlignedAllocator<U, ALIGNMENT>&)
+            {
+            }
+            
+            T* allocate(const std::size_t count)
+            {
+                void* memory = nullptr;
+                
+                if (posix_memalign(&memory, ALIGNMENT, count * sizeof(T)) != 0)
+                    throw std::bad_alloc();
+                
+                return static_cast<T*>(memory);
+            }
+            
+            void deallocate(T* memory, const std::size_t)
+            {
+                free(memory);
+            }
+            
+            template <typename U>
+            bool operator==(const AlignedAllocator<U, ALIGNMENT>&) const
+            {
+                return true;
+            }
+            
+            template <typename U>
+            bool operator!=(const AlignedAllocator<U, ALIGNMENT>&) const
+            {
+                return false;
+            }
+        };
+        
+        /// Logging helpers
+        
+        /// Stream buffer handing whole lines to the log file
+        ///
+        /// Each thread logs through its own buffer, the complete lines in
+        /// it are written to the file under a lock when the stream is
+        /// flushed, or when the buffer fills up. So the lines logged by
+        /// decoders running on different threads never mix.
+        class LogBuffer : public std::streambuf
+        {
+            public:
+                
+                LogBuffer();
+                
+                /// Write what's left in the buffer, even an unfinished line
+                ~LogBuffer();
+            
+            protected:
+                
+                int_type overflow(int_type ch) override;
+                
+                int sync() override;
+            
+            private:
+                
+                /// Write the complete lines in the buffer to the file
+                ///
+                /// @param all true to also write an unfinished line
+                /// @param flush true to flush the file afterwards
+                void writeLines(const bool all, const bool flush);
+            
+            private:
+                
+                static const std::size_t BUFFER_SIZE = 4096;
+                
+                char m_buffer[BUFFER_SIZE];
+        };
+        
+        /// Output stream of a thread's log
+        class LogStream : public std::ostream
+        {
+            public:
+                
+                LogStream();
+            
+            private:
+                
+                LogBuffer m_buffer;
+        };
+        
+        /// Threading helpers
+        
+        /// Get the number of threads to use for a requested thread count
+        ///
+        /// @param threads the requested number of threads, 0 for one per core
+        /// @return the number of threads to use, at least 1
+        inline unsigned resolveThreadCount(const unsigned threads)
+        {
+            if (threads != 0)
+                return threads;
+            
+            unsigned cores = std::thread::hardware_concurrency();
+            return cores == 0 ? 1 : cores;
+        }
+        
+        /// Call a function for every index in [0, count) using the specified number of threads
+        ///
+        /// The indices are handed out one at a time, so uneven amounts
+        /// of work per index are balanced between the threads. The function
+        /// is called on the calling thread when a single thread is used.
+        ///
+        /// @param count the number of indices
+        /// @param threads the number of threads to use
+        /// @param func the function to call with each index
+        template <typename Function>
+        void parallelFor(const std::size_t count, unsigned threads, Function func)
+        {
+            if (threads > count)
+                threads = count;
+            
+            if (threads <= 1)
+            {
+                for (std::size_t i = 0; i < count; ++i)
+                    func(i);
+                return;
+            }
+            
+            std::atomic<std::size_t> next(0);
+            
+            auto worker = [&]()
+            {
+                for (std::size_t i = next++; i < count; i = next++)
+                    func(i);
+            };
+            
+            std::vector<std::thread> pool;
+            for (unsigned t = 1; t < threads; ++t)
+                pool.emplace_back(worker);
+            
+            worker();
+            
+            for (auto&& thread : pool)
+                thread.join();
+        }
     }
 }
 
+// Output log file, ugly solution global for logging
+// into files! This approach is not recommended, I
+// used here to focus on JPEG, not logging! :p
+//
+// Every thread has its own log stream, writing to the same
+// file, so decoders on separate threads can log at once.
+extern thread_local kpeg::utils::LogStream logFile;
+
 #endif // UTILITY_HPP
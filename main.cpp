@@ -10,11 +10,22 @@ void printHelp()
     std::cout << "   K-PEG - Simple JPEG Encoder & Decoder"    << std::endl;
     std::cout << "===========================================" << std::endl;
     std::cout << "Help\n" << std::endl;
-    std::cout << "<filename.jpg>                  : Decompress a JPEG image to a PPM image" << std::endl;
+    std::cout << "[options] <filename.jpg>        : Decompress a JPEG image to a PPM image (PGM/YUV for gray/planar formats)" << std::endl;
     std::cout << "-h                              : Print this help message and exit" << std::endl;
+    std::cout << "\nOptions:" << std::endl;
+    std::cout << "-j <threads>                    : Decompress using the specified number of threads (0 = one per core)" << std::endl;
+    std::cout << "-x <threads>                    : Same as -j, also decoding images without restart markers in parallel" << std::endl;
+    std::cout << "-s <denominator>                : Decompress at 1/2, 1/4 or 1/8 scale" << std::endl;
+    std::cout << "-f <format>                     : Output pixel format: rgb8 (default, gray8 for grayscale images), bgr8, rgba8, bgra8, gray8, i420 or i444" << std::endl;
+    std::cout << "-u <mode>                       : Chroma upsampling: fancy (default) or simple" << std::endl;
 }
 
-void decodeJPEG(const std::string& filename)
+void decodeJPEG(const std::string& filename,
+                const unsigned threads = 1,
+                const bool speculative = false,
+                const unsigned scale = 1,
+                const int format = -1,
+                const kpeg::UpsamplingMode upsampling = kpeg::UPSAMPLING_FANCY)
 {
     if ( !kpeg::utils::isValidFilename( filename ) )
     {
@@ -22,10 +33,24 @@ void decodeJPEG(const std::string& filename)
         return;
     }
     
+    kpeg::Decoder decoder;
+    
+    if ( !decoder.setScale( scale ) )
+    {
+        std::cout << "Invalid scale passed, use 1, 2, 4 or 8." << std::endl;
+        return;
+    }
+    
     std::cout << "Decoding..." << std::endl;
     
-    kpeg::Decoder decoder;
+    decoder.setThreadCount( threads );
+    decoder.setSpeculativeDecoding( speculative );
     
+    // Without a format the decoder picks RGB8 or, for grayscale images, GRAY8
+    if ( format >= 0 )
+        decoder.setPixelFormat( kpeg::PixelFormat( format ) );
+    
+    decoder.setUpsamplingMode( upsampling );
     decoder.open( filename );
     if ( decoder.decodeImageFile() == kpeg::Decoder::ResultCode::DECODE_DONE )
     {
@@ -34,7 +59,7 @@ void decodeJPEG(const std::string& filename)
     
     decoder.close();
 
-    std::cout << "Generated file: " << filename.substr(0, filename.length() - 3 ) << ".ppm" << std::endl;
+    std::cout << "Generated file: " << filename.substr(0, filename.length() - 4 ) << kpeg::getRawFileExtension( decoder.getImage().getPixelFormat() ) << std::endl;
     std::cout << "Complete! Check log file \'kpeg.log\' for details." << std::endl;
 }
 
@@ -51,9 +76,53 @@ int handleInput(int argc, char** argv)
         printHelp();
         return EXIT_SUCCESS;
     }
-    else if ( argc == 2 )
+    
+    unsigned threads = 1, scale = 1;
+    bool speculative = false;
+    int format = -1;
+    kpeg::UpsamplingMode upsampling = kpeg::UPSAMPLING_FANCY;
+    int arg = 1;
+    
+    // Options with a value, followed by the file name
+    for ( ; arg + 2 < argc; arg += 2 )
+    {
+        std::string option = argv[arg];
+        
+        if ( option == "-j" || option == "-x" )
+        {
+            threads = std::stoul( argv[arg + 1] );
+            speculative = option == "-x";
+        }
+        else if ( option == "-s" )
+        {
+            scale = std::stoul( argv[arg + 1] );
+        }
+        else if ( option == "-f" )
+        {
+            int f = kpeg::PIXEL_FORMAT_RGB8;
+            
+            while ( f <= kpeg::PIXEL_FORMAT_I444 && argv[arg + 1] != (std::string)kpeg::getPixelFormatName( kpeg::PixelFormat(f) ) )
+                ++f;
+            
+            if ( f > kpeg::PIXEL_FORMAT_I444 )
+            {
+                std::cout << "Invalid pixel format passed, use -h to view the formats." << std::endl;
+                return EXIT_FAILURE;
+            }
+            
+            format = f;
+        }
+        else if ( option == "-u" && ( (std::string)argv[arg + 1] == "fancy" || (std::string)argv[arg + 1] == "simple" ) )
+        {
+            upsampling = (std::string)argv[arg + 1] == "fancy" ? kpeg::UPSAMPLING_FANCY : kpeg::UPSAMPLING_SIMPLE;
+        }
+        else
+            break;
+    }
+    
+    if ( arg == argc - 1 )
     {
-        decodeJPEG( argv[1] );
+        decodeJPEG( argv[arg], threads, speculative, scale, format, upsampling );
         return EXIT_SUCCESS;
     }
     
@@ -0,0 +1,69 @@
+/// Arena module implementation
+
+#include <algorithm>
+
+#include "Arena.hpp"
+
+namespace kpeg
+{
+    Arena::Arena(const std::size_t blockSize) :
+        m_blockSize{blockSize},
+        m_current{0},
+        m_offset{0},
+        m_usedBefore{0}
+    {
+    }
+    
+    void* Arena::allocate(const std::size_t size)
+    {
+        const std::size_t alignedSize = utils::alignSize(std::max<std::size_t>(size, 1), ALIGNMENT);
+        
+        // Move on to the next block that fits the allocation, adding one if none does
+        while (m_current < m_blocks.size() && m_offset + alignedSize > m_blocks[m_current].size())
+        {
+            m_usedBefore += m_offset;
+            m_offset = 0;
+            ++m_current;
+        }
+        
+        if (m_current == m_blocks.size())
+            m_blocks.emplace_back(std::max(m_blockSize, alignedSize));
+        
+        void* memory = m_blocks[m_current].data() + m_offset;
+        m_offset += alignedSize;
+        
+        return memory;
+    }
+    
+    void Arena::rewind()
+    {
+        // Merge the blocks once they've all been needed, a single block
+        // then holds what the last use took
+        if (m_current > 0)
+        {
+            std::size_t size = getCapacity();
+            
+            m_blocks.clear();
+            m_blocks.emplace_back(size);
+        }
+        
+        m_current = 0;
+        m_offset = 0;
+        m_usedBefore = 0;
+    }
+    
+    std::size_t Arena::getUsedSize() const
+    {
+        return m_usedBefore + m_offset;
+    }
+    
+    std::size_t Arena::getCapacity() const
+    {
+        std::size_t capacity = 0;
+        
+        for (auto&& block : m_blocks)
+            capacity += block.size();
+        
+        return capacity;
+    }
+}
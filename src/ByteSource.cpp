@@ -0,0 +1,102 @@
+/// Byte source module implementation
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ByteSource.hpp"
+#include "Utility.hpp"
+
+namespace kpeg
+{
+    MemorySource::MemorySource() :
+        m_data{nullptr},
+        m_size{0}
+    {
+    }
+    
+    MemorySource::MemorySource(const UInt8* data, const std::size_t size) :
+        m_data{data},
+        m_size{size}
+    {
+    }
+    
+    const UInt8* MemorySource::getData() const
+    {
+        return m_data;
+    }
+    
+    std::size_t MemorySource::getSize() const
+    {
+        return m_size;
+    }
+    
+    MappedFileSource::MappedFileSource() :
+        m_mapping{nullptr},
+        m_size{0}
+    {
+    }
+    
+    MappedFileSource::~MappedFileSource()
+    {
+        close();
+    }
+    
+    bool MappedFileSource::open(const std::string& filename)
+    {
+        close();
+        
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        
+        if (fd < 0)
+            return false;
+        
+        struct stat info;
+        
+        if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size == 0)
+        {
+            logFile << "Can't map \'" << filename << "\', not a non-empty regular file" << std::endl;
+            ::close(fd);
+            return false;
+        }
+        
+        void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        
+        // The mapping keeps the file open
+        ::close(fd);
+        
+        if (mapping == MAP_FAILED)
+        {
+            logFile << "Unable to map \'" << filename << "\' into memory" << std::endl;
+            return false;
+        }
+        
+        // The file is read front to back, once
+        madvise(mapping, info.st_size, MADV_SEQUENTIAL);
+        
+        m_mapping = mapping;
+        m_size = info.st_size;
+        
+        return true;
+    }
+    
+    void MappedFileSource::close()
+    {
+        if (m_mapping != nullptr)
+            munmap(m_mapping, m_size);
+        
+        m_mapping = nullptr;
+        m_size = 0;
+    }
+    
+    const UInt8* MappedFileSource::getData() const
+    {
+        return static_cast<const UInt8*>(m_mapping);
+    }
+    
+    std::size_t MappedFileSource::getSize() const
+    {
+        return m_size;
+    }
+}
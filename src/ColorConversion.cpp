@@ -0,0 +1,131 @@
+/// Color conversion module implementation
+
+#include <algorithm>
+
+#include "ColorConversion.hpp"
+#include "Utility.hpp"
+
+namespace kpeg
+{
+    /// Clamp a converted value to the sample range
+    static inline UInt8 clampSample(const int value)
+    {
+        return UInt8(std::max(0, std::min(value, 255)));
+    }
+    
+    /// Get the upsampled chrominance of a pixel
+    ///
+    /// Fancy upsampling first blends the near and far rows 3:1, into
+    /// column sums, then for horizontally subsampled chrominance the
+    /// column sums of the nearest and next nearest samples 3:1. The
+    /// rounding alternates between the two pixels of a sample, so the
+    /// errors don't all go one way.
+    ///
+    /// @param near the nearest row of chrominance samples
+    /// @param far the next nearest row of chrominance samples
+    /// @param x the index of the pixel in the row
+    /// @return the chrominance of the pixel
+    template <int H_FACTOR, UpsamplingMode MODE>
+    static inline int upsampleChroma(const UInt8* near, const UInt8* far, const std::size_t x)
+    {
+        if (H_FACTOR == 1)
+            return MODE == UPSAMPLING_FANCY ? (3 * near[x] + far[x] + 2) >> 2 : near[x];
+        
+        const UInt8* n = near + x / 2;
+        const UInt8* f = far + x / 2;
+        
+        if (MODE == UPSAMPLING_SIMPLE)
+            return n[0];
+        
+        int center = 3 * n[0] + f[0];
+        
+        if (x % 2 == 0)
+            return (3 * center + 3 * n[-1] + f[-1] + 8) >> 4;
+        
+        return (3 * center + 3 * n[1] + f[1] + 7) >> 4;
+    }
+    
+    template <PixelFormat FORMAT, int H_FACTOR, UpsamplingMode MODE>
+    static void convertRow(const UInt8* Y, const UInt8* Cb, const UInt8* Cr,
+                           const UInt8* CbFar, const UInt8* CrFar,
+                           UInt8* output, const std::size_t count)
+    {
+        typedef PackedRGBLayout<FORMAT> Layout;
+        
+        const int round = 1 << (YCC_FIX_BITS - 1);
+        
+        for (std::size_t i = 0; i < count; ++i, output += Layout::PIXEL_SIZE)
+        {
+            int cb = upsampleChroma<H_FACTOR, MODE>(Cb, CbFar, i) - 128;
+            int cr = upsampleChroma<H_FACTOR, MODE>(Cr, CrFar, i) - 128;
+            
+            output[Layout::RED] = clampSample(Y[i] + ((YCC_CR_TO_R * cr + round) >> YCC_FIX_BITS));
+            output[Layout::GREEN] = clampSample(Y[i] + ((YCC_CB_TO_G * cb + YCC_CR_TO_G * cr + round) >> YCC_FIX_BITS));
+            output[Layout::BLUE] = clampSample(Y[i] + ((YCC_CB_TO_B * cb + round) >> YCC_FIX_BITS));
+            
+            if (Layout::PIXEL_SIZE == 4)
+                output[Layout::ALPHA] = 255;
+        }
+    }
+    
+    /// Get the scalar conversion kernel for the specified format and upsampling
+    template <PixelFormat FORMAT>
+    static ColorConversionFunction getScalarKernel(const int hFactor, const UpsamplingMode mode)
+    {
+        if (hFactor == 2)
+            return mode == UPSAMPLING_FANCY ? convertRow<FORMAT, 2, UPSAMPLING_FANCY> : convertRow<FORMAT, 2, UPSAMPLING_SIMPLE>;
+        
+        return mode == UPSAMPLING_FANCY ? convertRow<FORMAT, 1, UPSAMPLING_FANCY> : convertRow<FORMAT, 1, UPSAMPLING_SIMPLE>;
+    }
+    
+    static ColorConversionFunction getScalarKernel(const PixelFormat format, const int hFactor, const UpsamplingMode mode)
+    {
+        switch (format)
+        {
+            case PIXEL_FORMAT_RGB8  : return getScalarKernel<PIXEL_FORMAT_RGB8>(hFactor, mode);
+            case PIXEL_FORMAT_BGR8  : return getScalarKernel<PIXEL_FORMAT_BGR8>(hFactor, mode);
+            case PIXEL_FORMAT_RGBA8 : return getScalarKernel<PIXEL_FORMAT_RGBA8>(hFactor, mode);
+            case PIXEL_FORMAT_BGRA8 : return getScalarKernel<PIXEL_FORMAT_BGRA8>(hFactor, mode);
+            default                 : return nullptr;
+        }
+    }
+    
+    void convertYCbCrToRGB(const UInt8* Y, const UInt8* Cb, const UInt8* Cr,
+                           const UInt8* CbFar, const UInt8* CrFar,
+                           UInt8* output, const std::size_t count,
+                           const PixelFormat format, const int hFactor, const UpsamplingMode mode)
+    {
+        getScalarKernel(format, hFactor, mode)(Y, Cb, Cr, CbFar, CrFar, output, count);
+    }
+    
+    ColorConversionFunction getYCbCrToRGBFunction(const PixelFormat format, const int hFactor, const UpsamplingMode mode)
+    {
+        if (getScalarKernel(format, hFactor, mode) == nullptr)
+            return nullptr;
+
+#if defined(KPEG_ENABLE_AVX2)
+        if (utils::isAVX2Supported())
+            return getYCbCrToRGBFunctionAVX2(format, hFactor, mode);
+#endif
+#if defined(__SSE2__)
+        return getYCbCrToRGBFunctionSSE2(format, hFactor, mode);
+#else
+        return getScalarKernel(format, hFactor, mode);
+#endif
+    }
+    
+    void upsampleChromaRow(const UInt8* near, const UInt8* far,
+                           UInt8* output, const std::size_t count,
+                           const int hFactor, const UpsamplingMode mode)
+    {
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            if (hFactor == 2)
+                output[i] = UInt8(mode == UPSAMPLING_FANCY ? upsampleChroma<2, UPSAMPLING_FANCY>(near, far, i)
+                                                           : upsampleChroma<2, UPSAMPLING_SIMPLE>(near, far, i));
+            else
+                output[i] = UInt8(mode == UPSAMPLING_FANCY ? upsampleChroma<1, UPSAMPLING_FANCY>(near, far, i)
+                                                           : upsampleChroma<1, UPSAMPLING_SIMPLE>(near, far, i));
+        }
+    }
+}
@@ -0,0 +1,254 @@
+/// AVX2 color conversion kernel
+///
+/// Built with AVX2 code generation, see the notes in IDCT_AVX2.cpp.
+
+#include "ColorConversion.hpp"
+
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+
+namespace kpeg
+{
+    /// Convert 16 pixels to one channel, given their luminance and
+    /// their interleaved (Cb - 128, Cr - 128) pairs
+    ///
+    /// Like the unpacking producing the pairs, this works within each
+    /// 128-bit lane, so the pixels come out in their original order.
+    static inline __m256i convertChannel(const __m256i Y,
+                                         const __m256i CbCrLow,
+                                         const __m256i CbCrHigh,
+                                         const __m256i factors)
+    {
+        const __m256i round = _mm256_set1_epi32(1 << (YCC_FIX_BITS - 1));
+        
+        __m256i low = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(CbCrLow, factors), round), YCC_FIX_BITS);
+        __m256i high = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(CbCrHigh, factors), round), YCC_FIX_BITS);
+        
+        return _mm256_add_epi16(Y, _mm256_packs_epi32(low, high));
+    }
+    
+    /// Interleave 16 bytes of each of three channels into 48 bytes of packed pixels
+    static inline void storePixels3(const __m128i R, const __m128i G, const __m128i B, UInt8* output)
+    {
+        // For each output vector, the byte of each channel going to each
+        // position, -128 (0x80) where the position takes another channel
+        const __m128i R0 = _mm_setr_epi8(   0, -128, -128,    1, -128, -128,    2, -128, -128,    3, -128, -128,    4, -128, -128,    5);
+        const __m128i R1 = _mm_setr_epi8(-128, -128,    6, -128, -128,    7, -128, -128,    8, -128, -128,    9, -128, -128,   10, -128);
+        const __m128i R2 = _mm_setr_epi8(-128,   11, -128, -128,   12, -128, -128,   13, -128, -128,   14, -128, -128,   15, -128, -128);
+        const __m128i G0 = _mm_setr_epi8(-128,    0, -128, -128,    1, -128, -128,    2, -128, -128,    3, -128, -128,    4, -128, -128);
+        const __m128i G1 = _mm_setr_epi8(   5, -128, -128,    6, -128, -128,    7, -128, -128,    8, -128, -128,    9, -128, -128,   10);
+        const __m128i G2 = _mm_setr_epi8(-128, -128,   11, -128, -128,   12, -128, -128,   13, -128, -128,   14, -128, -128,   15, -128);
+        const __m128i B0 = _mm_setr_epi8(-128, -128,    0, -128, -128,    1, -128, -128,    2, -128, -128,    3, -128, -128,    4, -128);
+        const __m128i B1 = _mm_setr_epi8(-128,    5, -128, -128,    6, -128, -128,    7, -128, -128,    8, -128, -128,    9, -128, -128);
+        const __m128i B2 = _mm_setr_epi8(  10, -128, -128,   11, -128, -128,   12, -128, -128,   13, -128, -128,   14, -128, -128,   15);
+        
+        __m128i out0 = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(R, R0), _mm_shuffle_epi8(G, G0)), _mm_shuffle_epi8(B, B0));
+        __m128i out1 = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(R, R1), _mm_shuffle_epi8(G, G1)), _mm_shuffle_epi8(B, B1));
+        __m128i out2 = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(R, R2), _mm_shuffle_epi8(G, G2)), _mm_shuffle_epi8(B, B2));
+        
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output), out0);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + 16), out1);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + 32), out2);
+    }
+    
+    /// Interleave 16 bytes of each of four channels into 64 bytes of packed pixels
+    static inline void storePixels4(const __m128i c0, const __m128i c1, const __m128i c2, const __m128i c3, UInt8* output)
+    {
+        __m128i c01Low = _mm_unpacklo_epi8(c0, c1);
+        __m128i c01High = _mm_unpackhi_epi8(c0, c1);
+        __m128i c23Low = _mm_unpacklo_epi8(c2, c3);
+        __m128i c23High = _mm_unpackhi_epi8(c2, c3);
+        
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output), _mm_unpacklo_epi16(c01Low, c23Low));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + 16), _mm_unpackhi_epi16(c01Low, c23Low));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + 32), _mm_unpacklo_epi16(c01High, c23High));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + 48), _mm_unpackhi_epi16(c01High, c23High));
+    }
+    
+    /// Interleave 16 pixels of each channel in the order of the pixel format
+    template <PixelFormat FORMAT>
+    static inline void storePixels(const __m128i R, const __m128i G, const __m128i B, UInt8* output)
+    {
+        typedef PackedRGBLayout<FORMAT> Layout;
+        
+        const __m128i alpha = _mm_set1_epi8(-1);
+        
+        if (Layout::PIXEL_SIZE == 4)
+        {
+            if (Layout::RED == 0)
+                storePixels4(R, G, B, alpha, output);
+            else
+                storePixels4(B, G, R, alpha, output);
+        }
+        else
+        {
+            if (Layout::RED == 0)
+                storePixels3(R, G, B, output);
+            else
+                storePixels3(B, G, R, output);
+        }
+    }
+    
+    /// Get the column sums (3 x near + far) of 16 chrominance samples, 16 bits each
+    static inline __m256i columnSums(const UInt8* near, const UInt8* far)
+    {
+        __m256i n = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(near)));
+        __m256i f = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(far)));
+        
+        return _mm256_add_epi16(_mm256_add_epi16(n, _mm256_slli_epi16(n, 1)), f);
+    }
+    
+    /// Load the upsampled chrominance of 32 pixels, 16 bits per pixel
+    ///
+    /// The pixels come out in the same order as the luminance widened
+    /// within each 128-bit lane: pixels 0-7 and 16-23 in the first
+    /// vector, 8-15 and 24-31 in the second.
+    ///
+    /// @param near the nearest row of chrominance samples, from the sample of the first pixel
+    /// @param far the next nearest row of chrominance samples, from the sample of the first pixel
+    /// @param chroma the chrominance of the pixels
+    template <int H_FACTOR, UpsamplingMode MODE>
+    static inline void loadChroma(const UInt8* near, const UInt8* far, __m256i chroma[2])
+    {
+        const __m256i zero = _mm256_setzero_si256();
+        
+        if (H_FACTOR == 1)
+        {
+            __m256i n = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(near));
+            
+            chroma[0] = _mm256_unpacklo_epi8(n, zero);
+            chroma[1] = _mm256_unpackhi_epi8(n, zero);
+            
+            if (MODE == UPSAMPLING_FANCY)
+            {
+                const __m256i round = _mm256_set1_epi16(2);
+                __m256i f = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(far));
+                
+                for (int half = 0; half < 2; ++half)
+                {
+                    __m256i f16 = half == 0 ? _mm256_unpacklo_epi8(f, zero) : _mm256_unpackhi_epi8(f, zero);
+                    __m256i sum = _mm256_add_epi16(_mm256_add_epi16(chroma[half], _mm256_slli_epi16(chroma[half], 1)), f16);
+                    
+                    chroma[half] = _mm256_srli_epi16(_mm256_add_epi16(sum, round), 2);
+                }
+            }
+            
+            return;
+        }
+        
+        if (MODE == UPSAMPLING_SIMPLE)
+        {
+            // Each sample covers two pixels
+            __m128i n = _mm_loadu_si128(reinterpret_cast<const __m128i*>(near));
+            __m256i pairs = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi8(n, n)),
+                                                    _mm_unpackhi_epi8(n, n), 1);
+            
+            chroma[0] = _mm256_unpacklo_epi8(pairs, zero);
+            chroma[1] = _mm256_unpackhi_epi8(pairs, zero);
+            return;
+        }
+        
+        // The even pixels weigh the sample on their left, the odd
+        // pixels the one on their right
+        __m256i left = columnSums(near - 1, far - 1);
+        __m256i center = columnSums(near, far);
+        __m256i right = columnSums(near + 1, far + 1);
+        
+        center = _mm256_add_epi16(center, _mm256_slli_epi16(center, 1));
+        
+        __m256i even = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(center, left), _mm256_set1_epi16(8)), 4);
+        __m256i odd = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(center, right), _mm256_set1_epi16(7)), 4);
+        
+        // Interleaving within the lanes puts the pixels in the luminance order
+        chroma[0] = _mm256_unpacklo_epi16(even, odd);
+        chroma[1] = _mm256_unpackhi_epi16(even, odd);
+    }
+    
+    template <PixelFormat FORMAT, int H_FACTOR, UpsamplingMode MODE>
+    static void convertRow(const UInt8* Y, const UInt8* Cb, const UInt8* Cr,
+                           const UInt8* CbFar, const UInt8* CrFar,
+                           UInt8* output, const std::size_t count)
+    {
+        typedef PackedRGBLayout<FORMAT> Layout;
+        
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i offset = _mm256_set1_epi16(128);
+        const __m256i factorsR = _mm256_broadcastsi128_si256(
+            _mm_setr_epi16(0, YCC_CR_TO_R, 0, YCC_CR_TO_R, 0, YCC_CR_TO_R, 0, YCC_CR_TO_R));
+        const __m256i factorsG = _mm256_broadcastsi128_si256(
+            _mm_setr_epi16(YCC_CB_TO_G, YCC_CR_TO_G, YCC_CB_TO_G, YCC_CR_TO_G,
+                           YCC_CB_TO_G, YCC_CR_TO_G, YCC_CB_TO_G, YCC_CR_TO_G));
+        const __m256i factorsB = _mm256_broadcastsi128_si256(
+            _mm_setr_epi16(YCC_CB_TO_B, 0, YCC_CB_TO_B, 0, YCC_CB_TO_B, 0, YCC_CB_TO_B, 0));
+        
+        std::size_t i = 0;
+        
+        for (; i + 32 <= count; i += 32)
+        {
+            __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(Y + i));
+            __m256i cb[2], cr[2];
+            
+            loadChroma<H_FACTOR, MODE>(Cb + i / H_FACTOR, CbFar + i / H_FACTOR, cb);
+            loadChroma<H_FACTOR, MODE>(Cr + i / H_FACTOR, CrFar + i / H_FACTOR, cr);
+            
+            __m256i channels[3][2];
+            
+            for (int half = 0; half < 2; ++half)
+            {
+                // Widen the luminance to 16 bits and center the chrominance around 0
+                __m256i y16 = half == 0 ? _mm256_unpacklo_epi8(y, zero) : _mm256_unpackhi_epi8(y, zero);
+                __m256i cb16 = _mm256_sub_epi16(cb[half], offset);
+                __m256i cr16 = _mm256_sub_epi16(cr[half], offset);
+                
+                __m256i CbCrLow = _mm256_unpacklo_epi16(cb16, cr16);
+                __m256i CbCrHigh = _mm256_unpackhi_epi16(cb16, cr16);
+                
+                channels[0][half] = convertChannel(y16, CbCrLow, CbCrHigh, factorsR);
+                channels[1][half] = convertChannel(y16, CbCrLow, CbCrHigh, factorsG);
+                channels[2][half] = convertChannel(y16, CbCrLow, CbCrHigh, factorsB);
+            }
+            
+            // Saturate to 8 bits, back in the original pixel order
+            __m256i R = _mm256_packus_epi16(channels[0][0], channels[0][1]);
+            __m256i G = _mm256_packus_epi16(channels[1][0], channels[1][1]);
+            __m256i B = _mm256_packus_epi16(channels[2][0], channels[2][1]);
+            
+            UInt8* out = output + i * Layout::PIXEL_SIZE;
+            
+            storePixels<FORMAT>(_mm256_castsi256_si128(R), _mm256_castsi256_si128(G), _mm256_castsi256_si128(B), out);
+            storePixels<FORMAT>(_mm256_extracti128_si256(R, 1), _mm256_extracti128_si256(G, 1), _mm256_extracti128_si256(B, 1),
+                                out + 16 * Layout::PIXEL_SIZE);
+        }
+        
+        // Finish the row with the SSE2 kernel
+        if (i < count)
+            getYCbCrToRGBFunctionSSE2(FORMAT, H_FACTOR, MODE)(Y + i, Cb + i / H_FACTOR, Cr + i / H_FACTOR,
+                                                              CbFar + i / H_FACTOR, CrFar + i / H_FACTOR,
+                                                              output + i * Layout::PIXEL_SIZE, count - i);
+    }
+    
+    /// Get the AVX2 conversion kernel for the specified format and upsampling
+    template <PixelFormat FORMAT>
+    static ColorConversionFunction getKernel(const int hFactor, const UpsamplingMode mode)
+    {
+        if (hFactor == 2)
+            return mode == UPSAMPLING_FANCY ? convertRow<FORMAT, 2, UPSAMPLING_FANCY> : convertRow<FORMAT, 2, UPSAMPLING_SIMPLE>;
+        
+        return mode == UPSAMPLING_FANCY ? convertRow<FORMAT, 1, UPSAMPLING_FANCY> : convertRow<FORMAT, 1, UPSAMPLING_SIMPLE>;
+    }
+    
+    ColorConversionFunction getYCbCrToRGBFunctionAVX2(const PixelFormat format, const int hFactor, const UpsamplingMode mode)
+    {
+        switch (format)
+        {
+            case PIXEL_FORMAT_RGB8  : return getKernel<PIXEL_FORMAT_RGB8>(hFactor, mode);
+            case PIXEL_FORMAT_BGR8  : return getKernel<PIXEL_FORMAT_BGR8>(hFactor, mode);
+            case PIXEL_FORMAT_RGBA8 : return getKernel<PIXEL_FORMAT_RGBA8>(hFactor, mode);
+            case PIXEL_FORMAT_BGRA8 : return getKernel<PIXEL_FORMAT_BGRA8>(hFactor, mode);
+            default                 : return nullptr;
+        }
+    }
+}
+
+#endif // __AVX2__
@@ -0,0 +1,222 @@
+/// SSE2 color conversion kernel
+
+#include "ColorConversion.hpp"
+
+#if defined(__SSE2__)
+
+#include <emmintrin.h>
+
+namespace kpeg
+{
+    /// Convert 8 pixels to one channel, given their luminance and
+    /// their interleaved (Cb - 128, Cr - 128) pairs
+    ///
+    /// @param Y the luminance, 16 bits per pixel
+    /// @param CbCrLow the chrominance pairs of the first 4 pixels
+    /// @param CbCrHigh the chrominance pairs of the last 4 pixels
+    /// @param factors the (Cb, Cr) factor pairs of the channel
+    /// @return the channel, 16 bits per pixel
+    static inline __m128i convertChannel(const __m128i Y,
+                                         const __m128i CbCrLow,
+                                         const __m128i CbCrHigh,
+                                         const __m128i factors)
+    {
+        const __m128i round = _mm_set1_epi32(1 << (YCC_FIX_BITS - 1));
+        
+        __m128i low = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(CbCrLow, factors), round), YCC_FIX_BITS);
+        __m128i high = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(CbCrHigh, factors), round), YCC_FIX_BITS);
+        
+        return _mm_add_epi16(Y, _mm_packs_epi32(low, high));
+    }
+    
+    /// Interleave 16 bytes of each of four channels into 64 bytes of packed pixels
+    static inline void storePixels4(const __m128i c0, const __m128i c1, const __m128i c2, const __m128i c3, UInt8* output)
+    {
+        __m128i c01Low = _mm_unpacklo_epi8(c0, c1);
+        __m128i c01High = _mm_unpackhi_epi8(c0, c1);
+        __m128i c23Low = _mm_unpacklo_epi8(c2, c3);
+        __m128i c23High = _mm_unpackhi_epi8(c2, c3);
+        
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output), _mm_unpacklo_epi16(c01Low, c23Low));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + 16), _mm_unpackhi_epi16(c01Low, c23Low));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + 32), _mm_unpacklo_epi16(c01High, c23High));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + 48), _mm_unpackhi_epi16(c01High, c23High));
+    }
+    
+    /// Get the column sums (3 x near + far) of 8 chrominance samples, 16 bits each
+    static inline __m128i columnSums(const UInt8* near, const UInt8* far)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        
+        __m128i n = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(near)), zero);
+        __m128i f = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(far)), zero);
+        
+        return _mm_add_epi16(_mm_add_epi16(n, _mm_slli_epi16(n, 1)), f);
+    }
+    
+    /// Load the upsampled chrominance of 16 pixels, 16 bits per pixel
+    ///
+    /// Computes the same values as the scalar upsampling.
+    ///
+    /// @param near the nearest row of chrominance samples, from the sample of the first pixel
+    /// @param far the next nearest row of chrominance samples, from the sample of the first pixel
+    /// @param chroma the chrominance of the first and the last 8 pixels
+    template <int H_FACTOR, UpsamplingMode MODE>
+    static inline void loadChroma(const UInt8* near, const UInt8* far, __m128i chroma[2])
+    {
+        const __m128i zero = _mm_setzero_si128();
+        
+        if (H_FACTOR == 1)
+        {
+            __m128i n = _mm_loadu_si128(reinterpret_cast<const __m128i*>(near));
+            
+            chroma[0] = _mm_unpacklo_epi8(n, zero);
+            chroma[1] = _mm_unpackhi_epi8(n, zero);
+            
+            if (MODE == UPSAMPLING_FANCY)
+            {
+                const __m128i round = _mm_set1_epi16(2);
+                __m128i f = _mm_loadu_si128(reinterpret_cast<const __m128i*>(far));
+                
+                for (int half = 0; half < 2; ++half)
+                {
+                    __m128i f16 = half == 0 ? _mm_unpacklo_epi8(f, zero) : _mm_unpackhi_epi8(f, zero);
+                    __m128i sum = _mm_add_epi16(_mm_add_epi16(chroma[half], _mm_slli_epi16(chroma[half], 1)), f16);
+                    
+                    chroma[half] = _mm_srli_epi16(_mm_add_epi16(sum, round), 2);
+                }
+            }
+            
+            return;
+        }
+        
+        if (MODE == UPSAMPLING_SIMPLE)
+        {
+            // Each sample covers two pixels
+            __m128i n = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(near));
+            __m128i pairs = _mm_unpacklo_epi8(n, n);
+            
+            chroma[0] = _mm_unpacklo_epi8(pairs, zero);
+            chroma[1] = _mm_unpackhi_epi8(pairs, zero);
+            return;
+        }
+        
+        // The even pixels weigh the sample on their left, the odd
+        // pixels the one on their right
+        __m128i left = columnSums(near - 1, far - 1);
+        __m128i center = columnSums(near, far);
+        __m128i right = columnSums(near + 1, far + 1);
+        
+        center = _mm_add_epi16(center, _mm_slli_epi16(center, 1));
+        
+        __m128i even = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(center, left), _mm_set1_epi16(8)), 4);
+        __m128i odd = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(center, right), _mm_set1_epi16(7)), 4);
+        
+        chroma[0] = _mm_unpacklo_epi16(even, odd);
+        chroma[1] = _mm_unpackhi_epi16(even, odd);
+    }
+    
+    template <PixelFormat FORMAT, int H_FACTOR, UpsamplingMode MODE>
+    static void convertRow(const UInt8* Y, const UInt8* Cb, const UInt8* Cr,
+                           const UInt8* CbFar, const UInt8* CrFar,
+                           UInt8* output, const std::size_t count)
+    {
+        typedef PackedRGBLayout<FORMAT> Layout;
+        
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i alpha = _mm_set1_epi8(-1);
+        const __m128i offset = _mm_set1_epi16(128);
+        const __m128i factorsR = _mm_setr_epi16(0, YCC_CR_TO_R, 0, YCC_CR_TO_R, 0, YCC_CR_TO_R, 0, YCC_CR_TO_R);
+        const __m128i factorsG = _mm_setr_epi16(YCC_CB_TO_G, YCC_CR_TO_G, YCC_CB_TO_G, YCC_CR_TO_G,
+                                                YCC_CB_TO_G, YCC_CR_TO_G, YCC_CB_TO_G, YCC_CR_TO_G);
+        const __m128i factorsB = _mm_setr_epi16(YCC_CB_TO_B, 0, YCC_CB_TO_B, 0, YCC_CB_TO_B, 0, YCC_CB_TO_B, 0);
+        
+        std::size_t i = 0;
+        
+        for (; i + 16 <= count; i += 16)
+        {
+            __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(Y + i));
+            __m128i cb[2], cr[2];
+            
+            loadChroma<H_FACTOR, MODE>(Cb + i / H_FACTOR, CbFar + i / H_FACTOR, cb);
+            loadChroma<H_FACTOR, MODE>(Cr + i / H_FACTOR, CrFar + i / H_FACTOR, cr);
+            
+            __m128i channels[3][2];
+            
+            for (int half = 0; half < 2; ++half)
+            {
+                // Widen the luminance to 16 bits and center the chrominance around 0
+                __m128i y16 = half == 0 ? _mm_unpacklo_epi8(y, zero) : _mm_unpackhi_epi8(y, zero);
+                __m128i cb16 = _mm_sub_epi16(cb[half], offset);
+                __m128i cr16 = _mm_sub_epi16(cr[half], offset);
+                
+                __m128i CbCrLow = _mm_unpacklo_epi16(cb16, cr16);
+                __m128i CbCrHigh = _mm_unpackhi_epi16(cb16, cr16);
+                
+                channels[0][half] = convertChannel(y16, CbCrLow, CbCrHigh, factorsR);
+                channels[1][half] = convertChannel(y16, CbCrLow, CbCrHigh, factorsG);
+                channels[2][half] = convertChannel(y16, CbCrLow, CbCrHigh, factorsB);
+            }
+            
+            // Saturate to 8 bits
+            __m128i R = _mm_packus_epi16(channels[0][0], channels[0][1]);
+            __m128i G = _mm_packus_epi16(channels[1][0], channels[1][1]);
+            __m128i B = _mm_packus_epi16(channels[2][0], channels[2][1]);
+            
+            UInt8* out = output + i * Layout::PIXEL_SIZE;
+            
+            if (Layout::PIXEL_SIZE == 4)
+            {
+                if (Layout::RED == 0)
+                    storePixels4(R, G, B, alpha, out);
+                else
+                    storePixels4(B, G, R, alpha, out);
+                
+                continue;
+            }
+            
+            // SSE2 has no byte shuffle to interleave three channels,
+            // so that's left to a scalar loop
+            alignas(16) UInt8 rgb[3][16];
+            
+            _mm_store_si128(reinterpret_cast<__m128i*>(rgb[0]), R);
+            _mm_store_si128(reinterpret_cast<__m128i*>(rgb[1]), G);
+            _mm_store_si128(reinterpret_cast<__m128i*>(rgb[2]), B);
+            
+            for (int p = 0; p < 16; ++p, out += 3)
+            {
+                out[Layout::RED] = rgb[0][p];
+                out[Layout::GREEN] = rgb[1][p];
+                out[Layout::BLUE] = rgb[2][p];
+            }
+        }
+        
+        if (i < count)
+            convertYCbCrToRGB(Y + i, Cb + i / H_FACTOR, Cr + i / H_FACTOR, CbFar + i / H_FACTOR, CrFar + i / H_FACTOR,
+                              output + i * Layout::PIXEL_SIZE, count - i, FORMAT, H_FACTOR, MODE);
+    }
+    
+    /// Get the SSE2 conversion kernel for the specified format and upsampling
+    template <PixelFormat FORMAT>
+    static ColorConversionFunction getKernel(const int hFactor, const UpsamplingMode mode)
+    {
+        if (hFactor == 2)
+            return mode == UPSAMPLING_FANCY ? convertRow<FORMAT, 2, UPSAMPLING_FANCY> : convertRow<FORMAT, 2, UPSAMPLING_SIMPLE>;
+        
+        return mode == UPSAMPLING_FANCY ? convertRow<FORMAT, 1, UPSAMPLING_FANCY> : convertRow<FORMAT, 1, UPSAMPLING_SIMPLE>;
+    }
+    
+    ColorConversionFunction getYCbCrToRGBFunctionSSE2(const PixelFormat format, const int hFactor, const UpsamplingMode mode)
+    {
+        switch (format)
+        {
+            case PIXEL_FORMAT_RGB8  : return getKernel<PIXEL_FORMAT_RGB8>(hFactor, mode);
+            case PIXEL_FORMAT_BGR8  : return getKernel<PIXEL_FORMAT_BGR8>(hFactor, mode);
+            case PIXEL_FORMAT_RGBA8 : return getKernel<PIXEL_FORMAT_RGBA8>(hFactor, mode);
+            case PIXEL_FORMAT_BGRA8 : return getKernel<PIXEL_FORMAT_BGRA8>(hFactor, mode);
+            default                 : return nullptr;
+        }
+    }
+}
+
+#endif // __SSE2__
@@ -1,23 +1,46 @@
 /// Implementation of the decoder
 
-#include <arpa/inet.h> // htons
+#include <algorithm>
 #include <iomanip>
-#include <sstream>
 
 #include "Decoder.hpp"
 #include "Markers.hpp"
+#include "ScanData.hpp"
 #include "Utility.hpp"
 
 namespace kpeg
 {
-    Decoder::Decoder()
+    Decoder::Decoder() :
+        m_source{nullptr},
+        m_dequantizationTables{},
+        m_restartInterval{0},
+        m_threadCount{1},
+        m_speculative{false},
+        m_frameWidth{0},
+        m_frameHeight{0},
+        m_scale{1},
+        m_IDCTKernel{IDCT_AUTO},
+        m_pixelFormat{PIXEL_FORMAT_RGB8},
+        m_pixelFormatSet{false},
+        m_upsampling{UPSAMPLING_FANCY},
+        m_coefficients{},
+        m_feedStage{FEED_SEGMENTS},
+        m_fed{false},
+        m_feedEnded{false},
+        m_feedResult{ResultCode::SUCCESS},
+        m_fedScan{},
+        m_fedPosition{},
+        m_fedScanStarted{false},
+        m_fedCorrupt{false},
+        m_nextFedMCU{0},
+        m_fedRetrySize{0}
     {
         logFile << "Created \'Decoder object\'." << std::endl;
     }
-            
-    Decoder::Decoder(const std::string& filename)
+    
+    Decoder::Decoder(const std::string& filename) :
+        Decoder()
     {
-        logFile << "Created \'Decoder object\'." << std::endl;
     }
     
     Decoder::~Decoder()
@@ -28,28 +51,123 @@ namespace kpeg
     
     bool Decoder::open(const std::string& filename)
     {
-        m_imageFile.open(filename, std::ios::in | std::ios::binary);
+        // A decoder decodes image after image, each from a clean state
+        reset();
         
-        if (!m_imageFile.is_open() || !m_imageFile.good())
+        if (!m_fileSource.open(filename))
         {
-            logFile << "Unable to open image: \'" + filename + "\'" << std::endl;
+            logFile << "Unable to open image: \'" << filename << "\'" << std::endl;
             return false;
         }
         
-        logFile << "Opened JPEG image: \'" + filename + "\'" << std::endl;
+        logFile << "Opened JPEG image: \'" << filename << "\'" << std::endl;
         
         m_filename = filename;
         
+        return open(m_fileSource);
+    }
+    
+    bool Decoder::open(const UInt8* data, const std::size_t size)
+    {
+        reset();
+        
+        m_memorySource = MemorySource(data, size);
+        
+        return open(m_memorySource);
+    }
+    
+    bool Decoder::open(const ByteSource& source)
+    {
+        // The built-in sources are set up by the other overloads
+        if (&source != &m_fileSource && &source != &m_memorySource)
+            reset();
+        
+        if (source.getData() == nullptr || source.getSize() == 0)
+        {
+            logFile << "Unable to open empty JFIF data" << std::endl;
+            return false;
+        }
+        
+        m_source = &source;
+        m_reader = ByteReader(source.getData(), source.getSize());
+        
+        logFile << "Decoding " << source.getSize() << " bytes of JFIF data" << std::endl;
+        
         return true;
     }
     
     void Decoder::close()
     {
-        m_imageFile.close();
-        logFile << "Closed image file: \'" + m_filename + "\'" << std::endl;
+        if (m_source == nullptr)
+            return;
+        
+        m_source = nullptr;
+        m_reader = ByteReader();
+        m_memorySource = MemorySource();
+        
+        if (m_fileSource.getData() != nullptr)
+        {
+            m_fileSource.close();
+            logFile << "Closed image file: \'" << m_filename << "\'" << std::endl;
+        }
+    }
+    
+    void Decoder::reset()
+    {
+        close();
+        m_fileSource.close();
+        m_filename.clear();
+        
+        // Clearing keeps the capacity of the containers for the next image
+        for (auto&& table : m_QTables)
+            table.clear();
+        
+        for (int type = 0; type < 2; ++type)
+        {
+            for (int number = 0; number < 2; ++number)
+            {
+                for (auto&& codeLength : m_huffmanTable[type][number])
+                {
+                    codeLength.first = 0;
+                    codeLength.second.clear();
+                }
+                
+                m_huffmanDecoder[type][number].reset();
+            }
+        }
+        
+        m_scanData.clear();
+        m_restartOffsets.clear();
+        m_restartInterval = 0;
+        m_frameWidth = 0;
+        m_frameHeight = 0;
+        m_components.clear();
+        m_blockComponents.clear();
+        m_MCU.clear();
+        m_arena.rewind();
+        
+        for (auto&& coefficients : m_coefficients)
+        {
+            coefficients.widthInBlocks = coefficients.heightInBlocks = 0;
+            coefficients.blocksPerRow = coefficients.blockRows = 0;
+            coefficients.coeffs.clear();
+        }
+        
+        m_feedStage = FEED_SEGMENTS;
+        m_fed = false;
+        m_feedEnded = false;
+        m_feedResult = ResultCode::SUCCESS;
+        m_feedData.clear();
+        m_fedScanStarted = false;
+        m_fedCorrupt = false;
+        m_nextFedMCU = 0;
+        m_fedRetrySize = 0;
+        
+        // The image keeps its buffers, they're reused when the next image is started
+        m_image.clear();
     }
     
-    Decoder::ResultCode Decoder::parseSegmentInfo(const UInt8 byte)
+    Decoder::ResultCode Decoder::parseSegmentInfo(const UInt8 byte, ByteReader& segment)
     {
         if (byte == JFIF_BYTE_0 || byte == JFIF_BYTE_FF)
             return ERROR;
@@ -57,10 +175,11 @@ namespace kpeg
         switch(byte)
         {
             case JFIF_SOI  : logFile  << "Found segment, Start of Image (FFD8)" << std::endl; return ResultCode::SUCCESS;
-            case JFIF_APP0 : logFile  << "Found segment, JPEG/JFIF Image Marker segment (APP0)" << std::endl; parseAPP0Segment(); return ResultCode::SUCCESS;
-            case JFIF_COM  : logFile  << "Found segment, Comment(FFFE)" << std::endl; parseCOMSegment(); return ResultCode::SUCCESS;
-            case JFIF_DQT  : logFile  << "Found segment, Define Quantization Table (FFDB)" << std::endl; parseDQTSegment(); return ResultCode::SUCCESS;
-            case JFIF_SOF0 : logFile  << "Found segment, Start of Frame 0: Baseline DCT (FFC0)" << std::endl; return parseSOF0Segment();
+            case JFIF_EOI  : logFile  << "Found segment, End of Image (FFD9)" << std::endl; return ResultCode::SUCCESS;
+            case JFIF_APP0 : logFile  << "Found segment, JPEG/JFIF Image Marker segment (APP0)" << std::endl; return parseAPP0Segment(segment);
+            case JFIF_COM  : logFile  << "Found segment, Comment(FFFE)" << std::endl; return parseCOMSegment(segment);
+            case JFIF_DQT  : logFile  << "Found segment, Define Quantization Table (FFDB)" << std::endl; return parseDQTSegment(segment);
+            case JFIF_SOF0 : logFile  << "Found segment, Start of Frame 0: Baseline DCT (FFC0)" << std::endl; return parseSOF0Segment(segment);
             case JFIF_SOF1 : logFile << "Found segment, Start of Frame 1: Extended Sequential DCT (FFC1), Not supported" << std::endl; return ResultCode::TERMINATE;
             case JFIF_SOF2 : logFile << "Found segment, Start of Frame 2: Progressive DCT (FFC2), Not supported" << std::endl; return ResultCode::TERMINATE;
             case JFIF_SOF3 : logFile << "Found segment, Start of Frame 3: Lossless Sequential (FFC3), Not supported" << std::endl; return ResultCode::TERMINATE;
@@ -73,8 +192,9 @@ namespace kpeg
             case JFIF_SOF13: logFile << "Found segment, Start of Frame 13: Differentical Sequential DCT, Arithmetic Coding (FFCD), Not supported" << std::endl; return ResultCode::TERMINATE;
             case JFIF_SOF14: logFile << "Found segment, Start of Frame 14: Differentical Progressive DCT, Arithmetic Coding (FFCE), Not supported" << std::endl; return ResultCode::TERMINATE;
             case JFIF_SOF15: logFile << "Found segment, Start of Frame 15: Differentical Lossless (Sequential), Arithmetic Coding (FFCF), Not supported" << std::endl; return ResultCode::TERMINATE;
-            case JFIF_DHT  : logFile  << "Found segment, Define Huffman Table (FFC4)" << std::endl; parseDHTSegment(); return ResultCode::SUCCESS;
-            case JFIF_SOS  : logFile  << "Found segment, Start of Scan (FFDA)" << std::endl; parseSOSSegment(); return ResultCode::SUCCESS;
+            case JFIF_DHT  : logFile  << "Found segment, Define Huffman Table (FFC4)" << std::endl; return parseDHTSegment(segment);
+            case JFIF_DRI  : logFile  << "Found segment, Define Restart Interval (FFDD)" << std::endl; return parseDRISegment(segment);
+            case JFIF_SOS  : logFile  << "Found segment, Start of Scan (FFDA)" << std::endl; return parseSOSSegment(segment);
         }
         
         return ResultCode::SUCCESS;
@@ -87,59 +207,341 @@ namespace kpeg
         if (extPos == std::string::npos)
             extPos = m_filename.find(".jpeg");
         
-        std::string targetFilename = m_filename.substr(0, extPos) + ".ppm";
-        m_image.dumpRawData(targetFilename);
+        std::string targetFilename = m_filename.substr(0, extPos) + getRawFileExtension(m_image.getPixelFormat());
+        
+        return m_image.dumpRawData(targetFilename);
+    }
+    
+    const Image& Decoder::getImage() const
+    {
+        return m_image;
+    }
+    
+    void Decoder::setThreadCount(const unsigned threads)
+    {
+        m_threadCount = threads;
+    }
+    
+    void Decoder::setSpeculativeDecoding(const bool enabled)
+    {
+        m_speculative = enabled;
+    }
+    
+    bool Decoder::setScale(const unsigned denominator)
+    {
+        if (denominator != 1 && denominator != 2 && denominator != 4 && denominator != 8)
+        {
+            logFile << "Unsupported scale 1/" << denominator << ", the scale must be 1/1, 1/2, 1/4 or 1/8" << std::endl;
+            return false;
+        }
         
+        m_scale = denominator;
         return true;
     }
     
+    void Decoder::setIDCTKernel(const IDCTKernel kernel)
+    {
+        m_IDCTKernel = kernel;
+    }
+    
+    void Decoder::setPixelFormat(const PixelFormat format)
+    {
+        m_pixelFormat = format;
+        m_pixelFormatSet = true;
+    }
+    
+    void Decoder::setUpsamplingMode(const UpsamplingMode mode)
+    {
+        m_upsampling = mode;
+    }
+    
+    Decoder::ResultCode Decoder::readHeader()
+    {
+        if (m_source == nullptr)
+        {
+            logFile << "No JFIF data to decode, open an image first" << std::endl;
+            return ResultCode::ERROR;
+        }
+        
+        ResultCode status = parseSegments(true);
+        
+        if (status == ResultCode::DECODE_DONE)
+        {
+            logFile << "[ FATAL ] No frame found in JFIF file!" << std::endl;
+            return ResultCode::ERROR;
+        }
+        
+        return status;
+    }
+    
+    PixelFormat Decoder::getPixelFormat() const
+    {
+        // Grayscale images stay grayscale unless another format was asked for
+        if (m_components.size() == 1 && !m_pixelFormatSet)
+            return PIXEL_FORMAT_GRAY8;
+        
+        return m_pixelFormat;
+    }
+    
     Decoder::ResultCode Decoder::decodeImageFile()
     {
-        if (!m_imageFile.is_open() || !m_imageFile.good())
+        return decode(nullptr, 0);
+    }
+    
+    Decoder::ResultCode Decoder::decodeImageFile(UInt8* buffer, const std::size_t size, const std::size_t stride)
+    {
+        // The size of the buffer needed is only known from the frame
+        if (m_components.empty())
+        {
+            ResultCode status = readHeader();
+            
+            if (status != ResultCode::SUCCESS)
+                return status;
+        }
+        
+        std::size_t required = getImageBufferSize(getPixelFormat(), m_image.width, m_image.height, stride);
+        
+        if (buffer == nullptr || required == 0 || size < required)
+        {
+            logFile << "Output buffer of " << size << " bytes with stride " << stride << " can't hold the "
+                    << m_image.width << "x" << m_image.height << " " << getPixelFormatName(getPixelFormat())
+                    << " image, " << required << " bytes needed" << std::endl;
+            return ResultCode::BUFFER_TOO_SMALL;
+        }
+        
+        return decode(buffer, stride);
+    }
+    
+    Decoder::ResultCode Decoder::feed(const UInt8* data, const std::size_t size)
+    {
+        if (m_source != nullptr)
         {
-            logFile << "Unable scan image file: \'" + m_filename + "\'" << std::endl;
+            logFile << "JFIF data can't be fed while other JFIF data is open" << std::endl;
             return ResultCode::ERROR;
         }
         
-        logFile << "Started decoding process..." << std::endl;
+        if (m_feedStage == FEED_FINISHED)
+            return m_feedResult;
         
-        UInt8 byte;
-        ResultCode status = ResultCode::DECODE_DONE;
+        if (!m_fed)
+            logFile << "Started decoding fed JFIF data..." << std::endl;
         
-        while (m_imageFile >> std::noskipws >> byte)
+        m_fed = true;
+        
+        if (size == 0)
+            m_feedEnded = true;
+        else
+            m_feedData.insert(m_feedData.end(), data, data + size);
+        
+        ResultCode status = ResultCode::NEED_MORE_DATA;
+        
+        while (true)
         {
-            if (byte == JFIF_BYTE_FF)
+            if (m_feedStage == FEED_SCAN)
             {
-                m_imageFile >> std::noskipws >> byte;
+                if (feedScanData() == ResultCode::NEED_MORE_DATA)
+                    return ResultCode::NEED_MORE_DATA;
                 
-                ResultCode code = parseSegmentInfo(byte);
+                m_feedStage = FEED_SEGMENTS;
+            }
+            
+            // Parse the segments fed so far, the bytes parsed are dropped
+            m_reader = ByteReader(m_feedData.data(), m_feedData.size());
+            status = parseSegments(false);
+            m_feedData.erase(m_feedData.begin(), m_feedData.begin() + m_reader.getPosition());
+            m_reader = ByteReader();
+            
+            if (status == ResultCode::NEED_MORE_DATA)
+                return status;
+            
+            if (status == ResultCode::SUCCESS && !m_fedScanStarted && !hasQuantizationTables())
+            {
+                status = ResultCode::ERROR;
+                break;
+            }
+            
+            // The scan data starts after the SOS segment
+            if (status == ResultCode::SUCCESS && !m_fedScanStarted)
+            {
+                startFedScan();
+                m_feedStage = FEED_SCAN;
+                continue;
+            }
+            
+            break;
+        }
+        
+        if (status == ResultCode::SUCCESS)
+        {
+            logFile << "Only a single scan is supported in fed JFIF data, terminating decoding process..." << std::endl;
+            status = ResultCode::TERMINATE;
+        }
+        else if (status == ResultCode::DECODE_DONE && m_components.empty())
+        {
+            logFile << "[ FATAL ] No frame found in JFIF file!" << std::endl;
+            status = ResultCode::ERROR;
+        }
+        else if (status == ResultCode::DECODE_DONE && !m_fedScanStarted)
+        {
+            logFile << " [ FATAL ] Invalid image scan data" << std::endl;
+            status = ResultCode::ERROR;
+        }
+        
+        if (status == ResultCode::DECODE_DONE)
+            logFile << "Finished decoding process [OK]." << std::endl;
+        else
+            logFile << "Stopped decoding fed JFIF data [NOT-OK]." << std::endl;
+        
+        m_feedStage = FEED_FINISHED;
+        m_feedResult = status;
+        m_feedData.clear();
+        
+        return status;
+    }
+    
+    Decoder::ResultCode Decoder::decodeCoefficients()
+    {
+        return decode(nullptr, 0, true);
+    }
+    
+    int Decoder::getComponentCount() const
+    {
+        return int(m_components.size());
+    }
+    
+    const ComponentCoefficients& Decoder::getCoefficients(const int component) const
+    {
+        return m_coefficients[component];
+    }
+    
+    /// Check whether a marker starts a segment, markers which don't
+    /// aren't followed by a segment length
+    ///
+    /// @param marker the second byte of the marker
+    /// @return true if the marker is followed by a segment, else false
+    static bool hasSegment(const UInt8 marker)
+    {
+        return marker != JFIF_SOI && marker != JFIF_EOI && marker != JFIF_TEM &&
+               !(marker >= JFIF_RST0 && marker <= JFIF_RST7) &&
+               marker != JFIF_BYTE_0 && marker != JFIF_BYTE_FF;
+    }
+    
+    Decoder::ResultCode Decoder::parseSegments(const bool untilFrame)
+    {
+        while (m_reader.getRemaining() > 0)
+        {
+            // Fed data may end anywhere, an incomplete marker is parsed
+            // again from its start once more data is fed
+            ByteReader marker = m_reader;
+            bool waitForData = m_fed && !m_feedEnded;
+            
+            UInt8 byte = m_reader.readByte();
+            
+            if (byte != JFIF_BYTE_FF)
+            {
+                logFile << "[ FATAL ] Invalid JFIF file! Terminating..." << std::endl;
+                return ResultCode::ERROR;
+            }
+            
+            // Markers may be preceded by any number of fill bytes
+            do
+            {
+                byte = m_reader.readByte();
+            }
+            while (byte == JFIF_BYTE_FF && m_reader.getRemaining() > 0);
+            
+            if (waitForData && (!m_reader.isGood() || byte == JFIF_BYTE_FF))
+            {
+                m_reader = marker;
+                return ResultCode::NEED_MORE_DATA;
+            }
+            
+            // Every segment has to be in the data, so the parsers
+            // can't read past its end
+            ByteReader segment;
+            
+            if (hasSegment(byte))
+            {
+                UInt16 length = m_reader.readWord();
                 
-                if (code == ResultCode::SUCCESS)
-                    continue;
-                else if (code == ResultCode::TERMINATE)
+                if (waitForData && (!m_reader.isGood() || (length >= 2 && m_reader.getRemaining() < std::size_t(length - 2))))
                 {
-                    status = ResultCode::TERMINATE;
-                    break;
+                    m_reader = marker;
+                    return ResultCode::NEED_MORE_DATA;
                 }
-                else if (code == ResultCode::DECODE_INCOMPLETE)
+                
+                if (!m_reader.isGood() || length < 2 || m_reader.getRemaining() < std::size_t(length - 2))
                 {
-                    status = ResultCode::DECODE_INCOMPLETE;
-                    break;
+                    logFile << "[ FATAL ] Truncated segment (FF" << std::hex << std::uppercase << (int)byte
+                            << std::dec << std::nouppercase << ") in JFIF file! Terminating..." << std::endl;
+                    return ResultCode::ERROR;
                 }
+                
+                segment = m_reader.readBlock(length - 2);
             }
-            else
+            
+            ResultCode code = parseSegmentInfo(byte, segment);
+            
+            if (code == ResultCode::TERMINATE || code == ResultCode::DECODE_INCOMPLETE || code == ResultCode::ERROR)
+                return code;
+            
+            // Anything after the end of the image isn't part of it
+            if (byte == JFIF_EOI)
+                return ResultCode::DECODE_DONE;
+            
+            if (untilFrame && byte == JFIF_SOF0 && code == ResultCode::SUCCESS)
+                return ResultCode::SUCCESS;
+            
+            // Fed scan data is decoded as it arrives, rather than copied in one go
+            if (byte == JFIF_SOS)
             {
-                logFile << "[ FATAL ] Invalid JFIF file! Terminating..." << std::endl;
-                status = ResultCode::ERROR;
-                break;
+                if (m_fed)
+                    return ResultCode::SUCCESS;
+                
+                scanImageData();
             }
         }
         
+        if (m_fed && !m_feedEnded)
+            return ResultCode::NEED_MORE_DATA;
+        
+        return ResultCode::DECODE_DONE;
+    }
+    
+    Decoder::ResultCode Decoder::decode(UInt8* buffer, const std::size_t stride, const bool coefficientsOnly)
+    {
+        if (m_source == nullptr)
+        {
+            logFile << "No JFIF data to decode, open an image first" << std::endl;
+            return ResultCode::ERROR;
+        }
+        
+        logFile << "Started decoding process..." << std::endl;
+        
+        ResultCode status = parseSegments(false);
+        
+        if (status == ResultCode::DECODE_DONE && m_components.empty())
+        {
+            logFile << "[ FATAL ] No frame found in JFIF file!" << std::endl;
+            status = ResultCode::ERROR;
+        }
+        
+        if (status == ResultCode::DECODE_DONE && !hasQuantizationTables())
+            status = ResultCode::ERROR;
+        
         if (status == ResultCode::DECODE_DONE)
         {
-            decodeScanData();
-            m_image.createImageFromMCUs(m_MCU);
-            logFile << "Finished decoding process [OK]." << std::endl;
+            if (!coefficientsOnly)
+                m_image.startImage(m_components, 8 / m_scale, getPixelFormat(), m_upsampling, buffer, stride);
+            
+            // No scan, or an empty one, is no image
+            if (decodeScanData(coefficientsOnly))
+                logFile << "Finished decoding process [OK]." << std::endl;
+            else
+            {
+                logFile << "Stopped decoding process [NOT-OK]." << std::endl;
+                status = ResultCode::ERROR;
+            }
         }
         else if (status == ResultCode::TERMINATE)
         {
@@ -154,41 +556,38 @@ namespace kpeg
         return status;
     }
     
-    void Decoder::parseAPP0Segment()
+    bool Decoder::hasQuantizationTables() const
     {
-        if (!m_imageFile.is_open() || !m_imageFile.good())
+        // Tables may be defined after the frame header, up to the scan
+        for (auto&& component : m_components)
         {
-            logFile << "Unable scan image file: \'" + m_filename + "\'" << std::endl;
-            return;
+            if (std::size_t(component.QTableID) >= m_QTables.size() || m_QTables[component.QTableID].size() != 64)
+            {
+                logFile << "[ FATAL ] Quantization table #" << component.QTableID << " of component "
+                        << (int)component.ID << " isn't defined!" << std::endl;
+                return false;
+            }
         }
         
+        return true;
+    }
+    
+    Decoder::ResultCode Decoder::parseAPP0Segment(ByteReader& segment)
+    {
         logFile << "Parsing JPEG/JFIF marker segment (APP-0)..." << std::endl;
-        
-        UInt16 lenByte = 0;
-        UInt8 byte = 0;
-        
-        m_imageFile.read(reinterpret_cast<char *>(&lenByte), 2);
-        lenByte = htons(lenByte);
-        std::size_t curPos = m_imageFile.tellg();
-        
-        logFile << "JFIF Application marker segment length: " << lenByte << std::endl;
+        logFile << "JFIF Application marker segment length: " << segment.getSize() + 2 << std::endl;
         
         // Skip the 'JFIF\0' bytes
-        m_imageFile.seekg(5, std::ios_base::cur);
+        segment.skip(5);
         
-        UInt8 majVersionByte, minVersionByte;
-        m_imageFile >> std::noskipws >> majVersionByte >> minVersionByte;
+        UInt8 majVersionByte = segment.readByte();
+        UInt8 minVersionByte = segment.readByte();
         
         logFile << "JFIF version: " << (int)majVersionByte << "." << (int)(minVersionByte >> 4) << (int)(minVersionByte & 0x0F) << std::endl;
         
-        std::string majorVersion = std::to_string(majVersionByte);
-        std::string minorVersion = std::to_string((int)(minVersionByte >> 4));
-        minorVersion +=  std::to_string((int)(minVersionByte & 0x0F));
-        
-        UInt8 densityByte;
-        m_imageFile >> std::noskipws >> densityByte;
+        UInt8 densityByte = segment.readByte();
         
-        std::string densityUnit = "";
+        const char* densityUnit = "";
         switch(densityByte)
         {
             case 0x00: densityUnit = "Pixel Aspect Ratio"; break;
@@ -198,572 +597,1098 @@ namespace kpeg
         
         logFile << "Image density unit: " << densityUnit << std::endl;
         
-        UInt16 xDensity = 0, yDensity = 0;
-        
-        m_imageFile.read(reinterpret_cast<char *>(&xDensity), 2);
-        m_imageFile.read(reinterpret_cast<char *>(&yDensity), 2);
-        
-        xDensity = htons(xDensity);
-        yDensity = htons(yDensity);
+        UInt16 xDensity = segment.readWord();
+        UInt16 yDensity = segment.readWord();
         
         logFile << "Horizontal image density: " << xDensity << std::endl;
         logFile << "Vertical image density: " << yDensity << std::endl;
         
-        // Ignore the image thumbnail data
-        UInt8 xThumb = 0, yThumb = 0;
-        m_imageFile >> std::noskipws >> xThumb >> yThumb;        
-        m_imageFile.seekg(3 * xThumb * yThumb, std::ios_base::cur);
+        // The image thumbnail data, if any, is the rest of the segment and ignored
         
-        logFile << "Finished parsing JPEG/JFIF marker segment (APP-0) [OK]" << std::endl;
+        if (!segment.isGood())
+            logFile << "Truncated JPEG/JFIF marker segment (APP-0), ignored" << std::endl;
+        else
+            logFile << "Finished parsing JPEG/JFIF marker segment (APP-0) [OK]" << std::endl;
+        
+        return ResultCode::SUCCESS;
     }
     
-    void Decoder::parseDQTSegment()
+    Decoder::ResultCode Decoder::parseDQTSegment(ByteReader& segment)
     {
-        if (!m_imageFile.is_open() || !m_imageFile.good())
-        {
-            logFile << "Unable scan image file: \'" + m_filename + "\'" << std::endl;
-            return;
-        }
-        
         logFile << "Parsing quantization table segment..." << std::endl;
+        logFile << "Quantization table segment length: " << segment.getSize() + 2 << std::endl;
         
-        UInt16 lenByte = 0;
-        UInt8 PqTq;
-        UInt8 Qi;
-        
-        m_imageFile.read(reinterpret_cast<char *>(&lenByte), 2);
-        lenByte = htons(lenByte);
-        logFile << "Quantization table segment length: " << (int)lenByte << std::endl;
-        
-        lenByte -= 2;
-        
-        for (int qt = 0; qt < int(lenByte) / 65; ++qt)
+        // A segment can define several tables, each 64 entries of 8 or 16 bits
+        while (segment.getRemaining() > 0)
         {
-            m_imageFile >> std::noskipws >> PqTq;
+            UInt8 PqTq = segment.readByte();
             
             int precision = PqTq >> 4; // Precision is always 8-bit for baseline DCT
             int QTtable = PqTq & 0x0F; // Quantization table number (0-3)
             
             logFile << "Quantization Table Number: " << QTtable << std::endl;
+            
+            // The precision is 0 for 8-bit and 1 for 16-bit entries, and there
+            // are four table destinations, ITU-T.81 section B.2.4.1
+            if (precision > 1 || QTtable > 3)
+            {
+                logFile << "[ FATAL ] Invalid quantization table precision or destination!" << std::endl;
+                return ResultCode::ERROR;
+            }
+            
             logFile << "Quantization Table #" << QTtable << " precision: " << (precision == 0 ? "8-bit" : "16-bit") << std::endl;
             
-            m_QTables.push_back({});
+            if (m_QTables.size() <= std::size_t(QTtable))
+                m_QTables.resize(QTtable + 1);
+            
+            m_QTables[QTtable].clear();
             
-            // Populate quantization table #QTtable            
+            // Populate quantization table #QTtable
             for (auto i = 0; i < 64; ++i)
+                m_QTables[QTtable].push_back(precision != 0 ? segment.readWord() : segment.readByte());
+            
+            if (!segment.isGood())
             {
-                m_imageFile >> std::noskipws >> Qi;
-                m_QTables[QTtable].push_back((UInt16)Qi);
+                logFile << "[ FATAL ] Truncated quantization table #" << QTtable << "!" << std::endl;
+                return ResultCode::ERROR;
             }
+            
+            // Prescale the table for the IDCT once, rather than per block
+            prepareDequantizationTable(m_QTables[QTtable], m_dequantizationTables[QTtable]);
         }
         
         logFile << "Finished parsing quantization table segment [OK]" << std::endl;
+        
+        return ResultCode::SUCCESS;
     }
     
-    Decoder::ResultCode Decoder::parseSOF0Segment()
+    Decoder::ResultCode Decoder::parseSOF0Segment(ByteReader& segment)
     {
-        if (!m_imageFile.is_open() || !m_imageFile.good())
-        {
-            logFile << "Unable scan image file: \'" + m_filename + "\'" << std::endl;
-            return ResultCode::ERROR;
-        }
-        
         logFile << "Parsing SOF-0 segment..." << std::endl;
+        logFile << "SOF-0 segment length: " << segment.getSize() + 2 << std::endl;
         
-        UInt16 lenByte, imgHeight, imgWidth;
-        UInt8 precision, compCount;
-        
-        m_imageFile.read(reinterpret_cast<char *>(&lenByte), 2);
-        lenByte = htons(lenByte);
-        
-        logFile << "SOF-0 segment length: " << (int)lenByte << std::endl;
-        
-        m_imageFile >> std::noskipws >> precision;
+        UInt8 precision = segment.readByte();
         logFile << "SOF-0 segment data precision: " << (int)precision << std::endl;
         
-        m_imageFile.read(reinterpret_cast<char *>(&imgHeight), 2);
-        m_imageFile.read(reinterpret_cast<char *>(&imgWidth), 2);
-        
-        imgHeight = htons(imgHeight);
-        imgWidth = htons(imgWidth);
+        UInt16 imgHeight = segment.readWord();
+        UInt16 imgWidth = segment.readWord();
         
         logFile << "Image height: " << (int)imgHeight << std::endl;
         logFile << "Image width: " << (int)imgWidth << std::endl;
         
-        m_imageFile >> std::noskipws >> compCount;
+        UInt8 compCount = segment.readByte();
         
         logFile << "No. of components: " << (int)compCount << std::endl;
         
-        UInt8 compID = 0, sampFactor = 0, QTNo = 0;
+        if (compCount != 1 && compCount != 3)
+        {
+            logFile << "Only images with 1 (grayscale) or 3 components (YCbCr) are supported, terminating..." << std::endl;
+            return ResultCode::TERMINATE;
+        }
         
-        bool isNonSampled = true;
+        m_components.clear();
+        m_blockComponents.clear();
         
-        for (auto i = 0; i < 3; ++i)
+        for (auto i = 0; i < compCount; ++i)
         {
-            m_imageFile >> std::noskipws >> compID >> sampFactor >> QTNo;
+            UInt8 compID = segment.readByte();
+            UInt8 sampFactor = segment.readByte();
+            UInt8 QTNo = segment.readByte();
+            
+            if (!segment.isGood())
+            {
+                logFile << "[ FATAL ] Truncated SOF-0 segment!" << std::endl;
+                m_components.clear();
+                return ResultCode::ERROR;
+            }
             
             logFile << "Component ID: " << (int)compID << std::endl;
             logFile << "Sampling Factor, Horizontal: " << int(sampFactor >> 4) << ", Vertical: " << int(sampFactor & 0x0F) << std::endl;
             logFile << "Quantization table no.: " << (int)QTNo << std::endl;
             
-            if ((sampFactor >> 4) != 1 || (sampFactor & 0x0F) != 1)
-                isNonSampled = false;
+            Component component;
+            component.ID = compID;
+            component.horizontalSampling = sampFactor >> 4;
+            component.verticalSampling = sampFactor & 0x0F;
+            component.QTableID = QTNo;
+            component.DCTableID = 0;
+            component.ACTableID = 0;
+            component.firstBlock = m_blockComponents.size();
+            
+            if (component.horizontalSampling < 1 || component.horizontalSampling > 4 ||
+                component.verticalSampling < 1 || component.verticalSampling > 4)
+            {
+                logFile << "Invalid sampling factors, terminating..." << std::endl;
+                return ResultCode::TERMINATE;
+            }
+            
+            // There are four quantization table destinations
+            if (QTNo > 3)
+            {
+                logFile << "[ FATAL ] Invalid quantization table no. " << (int)QTNo << " of component " << (int)compID << "!" << std::endl;
+                m_components.clear();
+                return ResultCode::ERROR;
+            }
+            
+            // The scan of a single component isn't interleaved, its MCUs
+            // are single blocks whatever its sampling factors are
+            if (compCount == 1)
+            {
+                component.horizontalSampling = 1;
+                component.verticalSampling = 1;
+            }
+            
+            // The blocks of each component follow each other in the MCUs
+            m_blockComponents.insert(m_blockComponents.end(), component.horizontalSampling * component.verticalSampling, i);
+            m_components.push_back(component);
         }
         
-        if (!isNonSampled)
+        // The chrominance may be subsampled by half in either direction,
+        // both chrominance components the same way
+        const Component& Y = m_components[0];
+        const Component& Cb = m_components[compCount == 3 ? 1 : 0];
+        const Component& Cr = m_components[compCount == 3 ? 2 : 0];
+        
+        if (Cb.horizontalSampling != Cr.horizontalSampling || Cb.verticalSampling != Cr.verticalSampling ||
+            (Y.horizontalSampling != Cb.horizontalSampling && Y.horizontalSampling != 2 * Cb.horizontalSampling) ||
+            (Y.verticalSampling != Cb.verticalSampling && Y.verticalSampling != 2 * Cb.verticalSampling))
         {
-            logFile << "Chroma subsampling not yet supported!" << std::endl;
-            logFile << "Chroma subsampling is not 4:4:4, terminating..." << std::endl;
+            logFile << "Chroma subsampling other than 4:4:4, 4:2:2, 4:4:0 or 4:2:0 is not supported, terminating..." << std::endl;
             return ResultCode::TERMINATE;
         }
         
-        logFile << "Finished parsing SOF-0 segment [OK]" << std::endl;        
-        m_image.width = imgWidth;
-        m_image.height = imgHeight;
-        
-        return ResultCode::SUCCESS;
-    }
-    
-    void Decoder::parseDHTSegment()
-    {   
-        if (!m_imageFile.is_open() || !m_imageFile.good())
+        if (m_blockComponents.size() > 10)
         {
-            logFile << "Unable scan image file: \'" + m_filename + "\'" << std::endl;
-            return;
+            logFile << "More than 10 blocks in an MCU, terminating..." << std::endl;
+            return ResultCode::TERMINATE;
         }
         
-        logFile << "Parsing Huffman table segment..." << std::endl;
+        logFile << "Finished parsing SOF-0 segment [OK]" << std::endl;
+        m_frameWidth = imgWidth;
+        m_frameHeight = imgHeight;
         
-        UInt16 len;
-        m_imageFile.read(reinterpret_cast<char *>(&len), 2);
-        len = htons(len);
+        m_image.width = (imgWidth + m_scale - 1) / m_scale;
+        m_image.height = (imgHeight + m_scale - 1) / m_scale;
         
-        logFile << "Huffman table length: " << (int)len << std::endl;
+        if (m_scale != 1)
+            logFile << "Decoding at 1/" << m_scale << " scale, output size: " << m_image.width << "x" << m_image.height << std::endl;
         
-        int segmentEnd = (int)m_imageFile.tellg() + len - 2;
+        return ResultCode::SUCCESS;
+    }
+    
+    Decoder::ResultCode Decoder::parseDHTSegment(ByteReader& segment)
+    {
+        logFile << "Parsing Huffman table segment..." << std::endl;
+        logFile << "Huffman table length: " << segment.getSize() + 2 << std::endl;
         
-        while (m_imageFile.tellg() < segmentEnd)
+        // A segment can define several tables
+        while (segment.getRemaining() > 0)
         {
-            UInt8 htinfo;
-            m_imageFile >> std::noskipws >> htinfo;
+            UInt8 htinfo = segment.readByte();
             
-            int HTType = int((htinfo & 0x10) >> 4);
+            int HTType = int(htinfo >> 4);
             int HTNumber = int(htinfo & 0x0F);
             
             logFile << "Huffman table type: " << HTType << std::endl;
             logFile << "Huffman table #: " << HTNumber << std::endl;
             
+            // The class is 0 for DC tables and 1 for AC tables, and there
+            // are four table destinations, ITU-T.81 section B.2.4.2
+            if (HTType > 1 || HTNumber > 3)
+            {
+                logFile << "[ FATAL ] Invalid Huffman table class or destination!" << std::endl;
+                return ResultCode::ERROR;
+            }
+            
+            // Baseline images have two tables of each class
+            if (HTNumber > 1)
+            {
+                logFile << "[ FATAL ] Invalid Huffman table number!" << std::endl;
+                return ResultCode::ERROR;
+            }
+            
             int totalSymbolCount = 0;
-            UInt8 symbolCount;
             
-            for (auto i = 1; i <= 16; ++i)
+            for (auto i = 0; i < 16; ++i)
             {
-                m_imageFile >> std::noskipws >> symbolCount;
-                m_huffmanTable[HTType][HTNumber][i-1].first = (int)symbolCount;
-                totalSymbolCount += (int)symbolCount;
+                m_huffmanTable[HTType][HTNumber][i].first = segment.readByte();
+                m_huffmanTable[HTType][HTNumber][i].second.clear();
+                totalSymbolCount += m_huffmanTable[HTType][HTNumber][i].first;
             }
             
             // Load the symbols
-            int syms = 0;
-            for (auto i = 0; syms < totalSymbolCount; )
-            {
-                // Read the next symbol, and add it to the
-                // proper slot in the Huffman table.
-                //
-                // Depndending upon the symbol count, say n, for the current
-                // symbol length, insert the next n symbols in the symbol
-                // list to it's proper spot in the Huffman table. This means,
-                // if symbol counts for symbols of lengths 1, 2 and 3 are 0,
-                // 5 and 2 respectively, the symbol list will contain 7
-                // symbols, out of which the first 5 are symbols with length
-                // 2, and the remaining 2 are of length 3.
-                UInt8 code;
-                m_imageFile >> std::noskipws >> code;
-                
-                if (m_huffmanTable[HTType][HTNumber][i].first == 0)
-                {
-                    while (m_huffmanTable[HTType][HTNumber][++i].first == 0);
-                }
-                
-                m_huffmanTable[HTType][HTNumber][i].second.push_back(code);
-                syms++;
-                
-                if (m_huffmanTable[HTType][HTNumber][i].first == m_huffmanTable[HTType][HTNumber][i].second.size())
-                    i++;
+            //
+            // The symbols are listed by increasing code length, if symbol
+            // counts for symbols of lengths 1, 2 and 3 are 0, 5 and 2
+            // respectively, the symbol list will contain 7 symbols, out
+            // of which the first 5 are symbols with length 2, and the
+            // remaining 2 are of length 3.
+            if (totalSymbolCount > 256 || std::size_t(totalSymbolCount) > segment.getRemaining())
+            {
+                logFile << "[ FATAL ] Invalid Huffman table, " << totalSymbolCount << " symbols!" << std::endl;
+                return ResultCode::ERROR;
+            }
+            
+            for (auto&& codeLength : m_huffmanTable[HTType][HTNumber])
+            {
+                for (auto i = 0; i < codeLength.first; ++i)
+                    codeLength.second.push_back(segment.readByte());
             }
             
             logFile << "Printing symbols for Huffman table (" << HTType << "," << HTNumber << ")..." << std::endl;
             
+            // The symbols are streamed straight to the log, without building strings
             int totalCodes = 0;
             for (auto i = 0; i < 16; ++i)
             {
-                std::string codeStr = "";
+                logFile << "Code length: " << i+1
+                                        << ", Symbol count: " << m_huffmanTable[HTType][HTNumber][i].second.size()
+                                        << ", Symbols: " << std::hex << std::setfill('0');
+                
                 for (auto&& symbol : m_huffmanTable[HTType][HTNumber][i].second)
                 {
-                    std::stringstream ss;
-                    ss << "0x" << std::hex << std::setfill('0') << std::setw(2) << std::setprecision(16) << (int)symbol;
-                    codeStr += ss.str() + " ";
+                    logFile << "0x" << std::setw(2) << (int)symbol << " ";
                     totalCodes++;
                 }
                 
-                logFile << "Code length: " << i+1
-                                        << ", Symbol count: " << m_huffmanTable[HTType][HTNumber][i].second.size()
-                                        << ", Symbols: " << codeStr << std::endl;
+                logFile << std::dec << std::setfill(' ') << std::endl;
             }
             
             logFile << "Total Huffman codes for Huffman table(Type:" << HTType << ",#:" << HTNumber << "): " << totalCodes << std::endl;
             
-            m_huffmanTree[HTType][HTNumber].constructHuffmanTree(m_huffmanTable[HTType][HTNumber]);
-            auto htree = m_huffmanTree[HTType][HTNumber].getTree();
-            logFile << "Huffman codes:-" << std::endl;
-            inOrder(htree);
+            std::shared_ptr<const HuffmanDecoder> decoder = getHuffmanDecoder(m_huffmanTable[HTType][HTNumber]);
+            
+            // The code counts of the table overflow the code space
+            if (decoder == nullptr)
+            {
+                logFile << "[ FATAL ] Unusable Huffman table (" << HTType << "," << HTNumber << ")!" << std::endl;
+                return ResultCode::ERROR;
+            }
+            
+            m_huffmanDecoder[HTType][HTNumber] = decoder;
+        }
+        
+        if (!segment.isGood())
+        {
+            logFile << "[ FATAL ] Truncated Huffman table segment!" << std::endl;
+            return ResultCode::ERROR;
         }
         
         logFile << "Finished parsing Huffman table segment [OK]" << std::endl;
+        
+        return ResultCode::SUCCESS;
     }
     
-    void Decoder::parseSOSSegment()
+    Decoder::ResultCode Decoder::parseDRISegment(ByteReader& segment)
     {
-        if (!m_imageFile.is_open() || !m_imageFile.good())
-        {
-            logFile << "Unable scan image file: \'" + m_filename + "\'" << std::endl;
-            return;
-        }
+        logFile << "Parsing restart interval segment..." << std::endl;
         
-        logFile << "Parsing SOS segment..." << std::endl;
+        UInt16 interval = segment.readWord();
         
-        UInt16 len;
+        logFile << "Restart interval segment length: " << segment.getSize() + 2 << std::endl;
+        logFile << "Restart interval (MCUs): " << interval << std::endl;
         
-        m_imageFile.read(reinterpret_cast<char *>(&len), 2);
-        len = htons(len);
+        if (!segment.isGood())
+        {
+            logFile << "[ FATAL ] Truncated restart interval segment!" << std::endl;
+            return ResultCode::ERROR;
+        }
         
-        logFile << "SOS segment length: " << len << std::endl;
+        m_restartInterval = interval;
         
-        UInt8 compCount; // Number of components
-        UInt16 compInfo; // Component ID and Huffman table used
+        logFile << "Finished parsing restart interval segment [OK]" << std::endl;
+        
+        return ResultCode::SUCCESS;
+    }
+    
+    Decoder::ResultCode Decoder::parseSOSSegment(ByteReader& segment)
+    {
+        logFile << "Parsing SOS segment..." << std::endl;
+        logFile << "SOS segment length: " << segment.getSize() + 2 << std::endl;
         
-        m_imageFile >> std::noskipws >> compCount;
+        UInt8 compCount = segment.readByte(); // Number of components
         
         if (compCount < 1 || compCount > 4)
         {
             logFile << "Invalid component count in image scan: " << (int)compCount << ", terminating decoding process..." << std::endl;
-            return;
+            return ResultCode::ERROR;
         }
         
         logFile << "Number of components in scan data: " << (int)compCount << std::endl;
         
+        if (compCount != m_components.size())
+        {
+            logFile << "Only scans of all the components are supported, terminating decoding process..." << std::endl;
+            return ResultCode::TERMINATE;
+        }
+        
         for (auto i = 0; i < compCount; ++i)
         {
-            m_imageFile.read(reinterpret_cast<char *>(&compInfo), 2);
-            compInfo = htons(compInfo);
-            
-            UInt8 cID = compInfo >> 8; // 1st byte denotes component ID 
+            UInt8 cID = segment.readByte(); // 1st byte denotes component ID
+            UInt8 tables = segment.readByte();
             
             // 2nd byte denotes the Huffman table used:
             // Bits 7 to 4: DC Table #(0 to 3)
             // Bits 3 to 0: AC Table #(0 to 3)
-            UInt8 DCTableNum = (compInfo & 0x00f0) >> 4;
-            UInt8 ACTableNum = (compInfo & 0x000f);
+            UInt8 DCTableNum = (tables & 0xf0) >> 4;
+            UInt8 ACTableNum = (tables & 0x0f);
             
             logFile << "Component ID: " << (int)cID << ", DC Table #: " << (int)DCTableNum << ", AC Table #: " << (int)ACTableNum << std::endl;
+            
+            // Baseline images have two tables of each class
+            if (DCTableNum > 1 || ACTableNum > 1)
+            {
+                logFile << "Invalid Huffman table number in image scan, terminating decoding process..." << std::endl;
+                return ResultCode::ERROR;
+            }
+            
+            for (auto&& component : m_components)
+            {
+                if (component.ID == cID)
+                {
+                    component.DCTableID = DCTableNum;
+                    component.ACTableID = ACTableNum;
+                }
+            }
         }
         
-        // Skip the next three bytes
-        for (auto i = 0; i < 3; ++i)
+        // Skip the next three bytes, the spectral selection and successive
+        // approximation, fixed for baseline images
+        segment.skip(3);
+        
+        if (!segment.isGood())
         {
-            UInt8 byte;
-            m_imageFile >> std::noskipws >> byte;
+            logFile << "[ FATAL ] Truncated SOS segment!" << std::endl;
+            return ResultCode::ERROR;
         }
         
         logFile << "Finished parsing SOS segment [OK]" << std::endl;
         
-        scanImageData();
+        return ResultCode::SUCCESS;
     }
     
     void Decoder::scanImageData()
     {
-        if (!m_imageFile.is_open() || !m_imageFile.good())
+        logFile << "Scanning image data..." << std::endl;
+        
+        // The scan data runs up to the next marker, it's copied out of the
+        // source with its stuffed bytes removed in the same pass
+        m_scanData.resize(m_reader.getRemaining());
+        
+        ScanDataInfo info = unstuffScanData(m_reader.getCurrent(), m_reader.getRemaining(), m_scanData.data(), m_restartOffsets);
+        m_scanData.resize(info.size);
+        
+        logFile << "Scan data size: " << info.size << " bytes, restart markers found: " << m_restartOffsets.size() << std::endl;
+        
+        // Continue parsing the segments from the marker that ended the scan data
+        m_reader.skip(info.markerOffset);
+        
+        logFile << "Finished scanning image data [OK]" << std::endl;
+    }
+    
+    Decoder::ResultCode Decoder::parseCOMSegment(ByteReader& segment)
+    {
+        logFile << "Parsing comment segment..." << std::endl;
+        logFile << "Comment segment length: " << segment.getSize() + 2 << std::endl;
+        
+        // The comment is logged as it's read, it isn't kept
+        logFile << "Comment segment content: ";
+        
+        while (segment.getRemaining() > 0)
+            logFile << static_cast<char>(segment.readByte());
+        
+        logFile << std::endl;
+        logFile << "Finished parsing comment segment [OK]" << std::endl;
+        
+        return ResultCode::SUCCESS;
+    }
+    
+    bool Decoder::decodeScanData(const bool coefficientsOnly)
+    {
+        if (m_scanData.empty())
         {
-            logFile << "Unable scan image file: \'" + m_filename + "\'" << std::endl;
-            return;
+            logFile << " [ FATAL ] Invalid image scan data" << std::endl;
+            return false;
         }
         
-        logFile << "Scanning image data..." << std::endl;
+        logFile << "Decoding image scan data..." << std::endl;
+        
+        ScanLayout scan = getScanLayout(coefficientsOnly);
+        checkRestartMarkers(scan);
         
-        UInt8 byte;
+        std::size_t intervalCount = scan.intervalCount;
+        int MCUsPerRow = scan.MCUsPerRow;
+        int MCUCount = scan.MCUCount;
         
-        while (m_imageFile >> std::noskipws >> byte)
+        unsigned threads = utils::resolveThreadCount(m_threadCount);
+        logFile << "Restart intervals: " << intervalCount << ", decoding threads: " << threads << std::endl;
+        
+        // Decoding in parallel needs the coefficients of all the MCUs,
+        // decoding on a single thread streams the MCUs a row at a time,
+        // only keeping the row being decoded
+        bool speculative = m_restartInterval == 0 && m_speculative && threads > 1;
+        bool parallel = speculative || (intervalCount > 1 && threads > 1);
+        
+        startScan(scan, parallel ? MCUCount : MCUsPerRow);
+        
+        std::atomic<bool> corrupt(false);
+        
+        if (speculative)
+        {
+            logFile << "Decoding image scan data speculatively..." << std::endl;
+            corrupt = !decodeSpeculatively(MCUCount, threads);
+        }
+        else if (parallel)
         {
-            if (byte == JFIF_BYTE_FF)
+            utils::parallelFor(intervalCount, threads, [&](const std::size_t interval)
             {
-                UInt8 prevByte = byte;
-                
-                m_imageFile >> std::noskipws >> byte;
+                std::size_t start = interval == 0 ? 0 : m_restartOffsets[interval - 1];
+                std::size_t end = interval + 1 < intervalCount ? m_restartOffsets[interval] : m_scanData.size();
                 
-                if (byte == JFIF_EOI)
-                {
-                    logFile << "Found segment, End of Image (FFD9)" << std::endl;
-                    return;
-                }
+                // The last interval takes any MCUs left over by missing restart markers
+                int firstMCU = interval * m_restartInterval;
+                int endMCU = interval + 1 < intervalCount ? firstMCU + m_restartInterval : MCUCount;
                 
-                std::bitset<8> bits1(prevByte);
-                logFile << "0x" << std::hex << std::setfill('0') << std::setw(2)
-                                          << std::setprecision(8) << (int)prevByte
-                                          << ", Bits: " << bits1 << std::endl;
-                                          
-                m_scanData.append(bits1.to_string());
-            }
+                if (!decodeRestartInterval(m_scanData.data() + start, end - start, firstMCU, endMCU))
+                    corrupt = true;
+            });
+        }
+        
+        ScanPosition position;
+        startRestartInterval(position, 0, intervalCount);
+        
+        // Each row of MCUs goes to the image as soon as it's decoded, the
+        // image copies the samples out so the MCUs can be reused
+        for (int row = 0; row < scan.MCURows; ++row)
+        {
+            MCU* MCUs = &m_MCU[parallel ? row * MCUsPerRow : 0];
             
-            std::bitset<8> bits(byte);
-            logFile << "0x" << std::hex << std::setfill('0') << std::setw(2)
-                                      << std::setprecision(8) << (int)byte
-                                      << ", Bits: " << bits << std::endl;
+            if (!parallel && !decodeMCURow(position, row * MCUsPerRow, MCUsPerRow, intervalCount, MCUs))
+                corrupt = true;
             
-            m_scanData.append(bits.to_string());
+            finishMCURow(scan, row, MCUs);
         }
         
-        logFile << "Finished scanning image data [OK]" << std::endl;
+        finishScan(corrupt);
+        
+        return true;
+    }
+    
+    Decoder::ScanLayout Decoder::getScanLayout(const bool coefficientsOnly) const
+    {
+        ScanLayout scan = {};
+        
+        // The MCUs span the blocks of the components with the largest
+        // sampling factors, the luminance, the MCUs on the right and
+        // bottom edges may extend past the image
+        int MCUWidth = 8 * m_components[0].horizontalSampling;
+        int MCUHeight = 8 * m_components[0].verticalSampling;
+        scan.MCUsPerRow = (m_frameWidth + MCUWidth - 1) / MCUWidth;
+        scan.MCURows = (m_frameHeight + MCUHeight - 1) / MCUHeight;
+        scan.MCUCount = scan.MCUsPerRow * scan.MCURows;
+        
+        // Split the scan data at the restart markers, each restart
+        // interval can be decoded independently of the others
+        scan.intervalCount = 1;
+        
+        if (m_restartInterval > 0)
+            scan.intervalCount = (scan.MCUCount + m_restartInterval - 1) / m_restartInterval;
+        
+        scan.coefficientsOnly = coefficientsOnly;
+        
+        return scan;
+    }
+    
+    void Decoder::checkRestartMarkers(ScanLayout& scan) const
+    {
+        if (m_restartInterval == 0 || scan.intervalCount == m_restartOffsets.size() + 1)
+            return;
+        
+        logFile << "Expected " << scan.intervalCount - 1 << " restart markers, found "
+                << m_restartOffsets.size() << ", possibly corrupt JFIF data stream!" << std::endl;
+        scan.intervalCount = std::min(scan.intervalCount, m_restartOffsets.size() + 1);
     }
     
-    void Decoder::parseCOMSegment()
+    void Decoder::startScan(ScanLayout& scan, const std::size_t MCUsKept)
     {
-        if (!m_imageFile.is_open() || !m_imageFile.good())
+        // The MCUs' blocks come from the arena, the vector keeps its capacity between images
+        m_MCU.clear();
+        m_MCU.reserve(MCUsKept);
+        
+        for (std::size_t i = 0; i < MCUsKept; ++i)
+            m_MCU.emplace_back(int(m_blockComponents.size()), m_arena);
+        
+        logFile << "MCU count: " << scan.MCUCount << ", blocks per MCU: " << m_blockComponents.size()
+                << ", MCUs kept: " << m_MCU.size() << std::endl;
+        
+        // Convert the coefficient blocks to pixels
+        int blockSize = 8 / m_scale;
+        scan.idct = getIDCTFunction(m_IDCTKernel, blockSize);
+        
+        if (scan.coefficientsOnly)
+            logFile << "Keeping the coefficients, no IDCT" << std::endl;
+        else if (blockSize == 8)
+            logFile << "IDCT kernel: " << getIDCTKernelName(m_IDCTKernel == IDCT_AUTO ? getDefaultIDCTKernel() : m_IDCTKernel) << std::endl;
+        else
+            logFile << "IDCT kernel: scaled " << blockSize << "x" << blockSize << std::endl;
+        
+        // The quantization table of each block in an MCU
+        scan.tables = m_arena.allocate<const DequantizationTable*>(m_blockComponents.size());
+        
+        for (std::size_t i = 0; i < m_blockComponents.size(); ++i)
+            scan.tables[i] = &m_dequantizationTables[m_components[m_blockComponents[i]].QTableID];
+        
+        if (!scan.coefficientsOnly)
+            return;
+        
+        // The coefficients of each component cover the same MCUs as the image
+        int maxHorizontalSampling = m_components[0].horizontalSampling;
+        int maxVerticalSampling = m_components[0].verticalSampling;
+        
+        for (std::size_t c = 0; c < m_components.size(); ++c)
         {
-            logFile << "Unable scan image file: \'" + m_filename + "\'" << std::endl;
+            const Component& component = m_components[c];
+            ComponentCoefficients& coefficients = m_coefficients[c];
+            
+            std::size_t width = (m_frameWidth * component.horizontalSampling + maxHorizontalSampling - 1) / maxHorizontalSampling;
+            std::size_t height = (m_frameHeight * component.verticalSampling + maxVerticalSampling - 1) / maxVerticalSampling;
+            
+            coefficients.widthInBlocks = (width + 7) / 8;
+            coefficients.heightInBlocks = (height + 7) / 8;
+            coefficients.blocksPerRow = scan.MCUsPerRow * component.horizontalSampling;
+            coefficients.blockRows = scan.MCURows * component.verticalSampling;
+            coefficients.coeffs.resize(64 * coefficients.blocksPerRow * coefficients.blockRows);
+            
+            const std::vector<UInt16>& QTable = m_QTables[component.QTableID];
+            
+            for (int k = 0; k < 64; ++k)
+                coefficients.quantizationTable[ZIGZAG_TO_NATURAL[k]] = k < int(QTable.size()) ? QTable[k] : 0;
+        }
+    }
+    
+    void Decoder::finishMCURow(const ScanLayout& scan, const int MCURow, MCU* MCUs)
+    {
+        if (scan.coefficientsOnly)
+        {
+            storeCoefficients(MCURow, scan.MCUsPerRow, MCUs);
             return;
         }
         
-        logFile << "Parsing comment segment..." << std::endl;
+        for (int m = 0; m < scan.MCUsPerRow; ++m)
+            MCUs[m].constructMCU(scan.idct, scan.tables);
+        
+        m_image.addMCURow(MCUs);
+    }
+    
+    void Decoder::finishScan(const bool corrupt)
+    {
+        if (corrupt)
+            logFile << "[ FATAL ] Invalid huffman code, possibly corrupt JFIF data stream!" << std::endl;
+        
+        // Only the image is kept, the memory of the MCUs is reused by the next image
+        m_MCU.clear();
+        m_arena.rewind();
         
-        UInt16 lenByte = 0;
-        UInt8 byte = 0;
-        std::string comment;
+        // The remaining bits, if any, in the scan data are discarded as
+        // they're added byte align the scan data.
+        
+        logFile << "Finished decoding image scan data [OK]" << std::endl;
+    }
+    
+    void Decoder::startFedScan()
+    {
+        logFile << "Decoding image scan data as it's fed..." << std::endl;
+        
+        m_image.startImage(m_components, 8 / m_scale, getPixelFormat(), m_upsampling);
+        
+        m_scanData.clear();
+        m_restartOffsets.clear();
+        
+        // The rows are decoded serially as their scan data arrives, so only
+        // a row of MCUs is kept
+        m_fedScan = getScanLayout(false);
+        startScan(m_fedScan, m_fedScan.MCUsPerRow);
+        startRestartInterval(m_fedPosition, 0, m_fedScan.intervalCount);
         
-        m_imageFile.read(reinterpret_cast<char *>(&lenByte), 2);
-        lenByte = htons(lenByte);
-        std::size_t curPos = m_imageFile.tellg();
+        m_fedScanStarted = true;
+        m_fedCorrupt = false;
+        m_nextFedMCU = 0;
+        m_fedRetrySize = 0;
+    }
+    
+    Decoder::ResultCode Decoder::feedScanData()
+    {
+        // The data fed since the last call is appended to the scan data,
+        // without its stuffed bytes and restart markers. A 0xFF byte at the
+        // end can't be told apart from a marker yet, it's left for later.
+        std::size_t offset = m_scanData.size();
+        m_scanData.resize(offset + m_feedData.size());
+        
+        ScanDataInfo info = unstuffScanData(m_feedData.data(), m_feedData.size(), m_scanData.data() + offset, m_fedRestartOffsets);
+        m_scanData.resize(offset + info.size);
+        
+        for (std::size_t restartOffset : m_fedRestartOffsets)
+            m_restartOffsets.push_back(offset + restartOffset);
         
-        logFile << "Comment segment length: " << lenByte << std::endl;
+        // The scan data ends at the first marker that isn't a restart
+        // marker, the segments are parsed again from there
+        bool markerFound = info.markerOffset + 1 < m_feedData.size();
+        bool complete = markerFound || m_feedEnded;
+        std::size_t consumed = markerFound || !m_feedEnded ? info.markerOffset : m_feedData.size();
         
-        for (auto i = 0; i < lenByte - 2; ++i)
+        m_feedData.erase(m_feedData.begin(), m_feedData.begin() + consumed);
+        
+        if (complete)
         {
-            m_imageFile >> std::noskipws >> byte;
+            logFile << "Scan data size: " << m_scanData.size() << " bytes, restart markers found: " << m_restartOffsets.size() << std::endl;
+            checkRestartMarkers(m_fedScan);
+        }
+        
+        decodeFedMCUs(complete);
+        
+        if (!complete)
+            return ResultCode::NEED_MORE_DATA;
+        
+        finishScan(m_fedCorrupt);
+        
+        return ResultCode::SUCCESS;
+    }
+    
+    void Decoder::decodeFedMCUs(const bool complete)
+    {
+        // Don't try the next MCU again until enough scan data has arrived
+        if (!complete && m_scanData.size() < m_fedRetrySize)
+            return;
+        
+        const int MCUsPerRow = m_fedScan.MCUsPerRow;
+        const std::size_t intervalCount = m_fedScan.intervalCount;
+        
+        // The scan data has grown, and may have moved, since the position
+        // was saved, the reader picks up at the same bit
+        std::size_t bitPosition = m_fedPosition.reader.bitPosition();
+        m_fedPosition.reader = getIntervalReader(m_fedPosition.interval, intervalCount);
+        m_fedPosition.reader.seek(bitPosition);
+        
+        for (; m_nextFedMCU < m_fedScan.MCUCount; ++m_nextFedMCU)
+        {
+            // Restart intervals start at their restart markers, which have to be in
+            std::size_t interval = m_restartInterval > 0 ? m_nextFedMCU / m_restartInterval : 0;
             
-            if (byte == JFIF_BYTE_FF)
+            if (!complete && interval > m_restartOffsets.size())
+                return;
+            
+            ScanPosition position = m_fedPosition;
+            MCU* MCUs = &m_MCU[m_nextFedMCU % MCUsPerRow];
+            
+            bool valid = decodeMCURow(position, m_nextFedMCU, 1, intervalCount, MCUs);
+            
+            // The MCU is final once all its scan data has arrived: its
+            // restart interval ended at a marker, or it stayed within the
+            // data. Otherwise it read bits that haven't arrived yet, and is
+            // decoded again from the saved position when they have.
+            bool intervalEnded = position.interval + 1 < intervalCount && position.interval < m_restartOffsets.size();
+            std::size_t start = position.interval == 0 ? 0 : m_restartOffsets[position.interval - 1];
+            
+            if (!complete && !intervalEnded && (!valid || position.reader.bitPosition() > 8 * (m_scanData.size() - start)))
             {
-                logFile << "Unexpected start of marker at offest: " << curPos + i << std::endl;
-                logFile << "Comment segment content: " << comment << std::endl;
+                // Wait for about as much data as an MCU takes on average,
+                // or half again as much as the MCU has already read
+                std::size_t MCUStart = start + m_fedPosition.reader.bitPosition() / 8;
+                std::size_t MCUSize = m_nextFedMCU > 0 ? MCUStart / m_nextFedMCU : 0;
+                
+                m_fedRetrySize = std::max(MCUStart + MCUSize, m_scanData.size() + std::max<std::size_t>(1, (m_scanData.size() - MCUStart) / 2));
                 return;
             }
             
-            comment.push_back(static_cast<char>(byte));
+            m_fedPosition = position;
+            
+            if (!valid)
+                m_fedCorrupt = true;
+            
+            // Each row of MCUs goes to the image as soon as it's decoded
+            if ((m_nextFedMCU + 1) % MCUsPerRow == 0)
+                finishMCURow(m_fedScan, m_nextFedMCU / MCUsPerRow, m_MCU.data());
         }
+    }
+    
+    void Decoder::startRestartInterval(ScanPosition& position,
+                                       const std::size_t interval,
+                                       const std::size_t intervalCount) const
+    {
+        position.reader = getIntervalReader(interval, intervalCount);
+        position.interval = interval;
+        position.corrupt = false;
+        std::fill(std::begin(position.DCPredictor), std::end(position.DCPredictor), 0);
+    }
+    
+    BitReader Decoder::getIntervalReader(const std::size_t interval, const std::size_t intervalCount) const
+    {
+        std::size_t start = interval == 0 ? 0 : m_restartOffsets[interval - 1];
+        std::size_t end = interval + 1 < intervalCount && interval < m_restartOffsets.size() ? m_restartOffsets[interval] : m_scanData.size();
         
-        logFile << "Comment segment content: " << comment << std::endl;
-        logFile << "Finished parsing comment segment [OK]" << std::endl;
+        return BitReader(m_scanData.data() + start, end - start);
     }
     
-    void Decoder::byteStuffScanData()
+    void Decoder::storeCoefficients(const int MCURow, const int MCUsPerRow, MCU* MCUs)
     {
-        if (m_scanData.empty())
+        for (std::size_t block = 0; block < m_blockComponents.size(); ++block)
         {
-            logFile << " [ FATAL ] Invalid image scan data" << std::endl;
-            return;
+            int compID = m_blockComponents[block];
+            const Component& component = m_components[compID];
+            ComponentCoefficients& coefficients = m_coefficients[compID];
+            
+            // The position of the block in the component, the blocks of
+            // a component are in row-major order in each MCU
+            int blockInMCU = int(block) - component.firstBlock;
+            std::size_t row = MCURow * component.verticalSampling + blockInMCU / component.horizontalSampling;
+            std::size_t column = blockInMCU % component.horizontalSampling;
+            
+            Int16* output = coefficients.coeffs.data() + 64 * (row * coefficients.blocksPerRow + column);
+            
+            for (int m = 0; m < MCUsPerRow; ++m, output += 64 * component.horizontalSampling)
+                std::copy_n(MCUs[m].getCoefficients(int(block)).coeffs.data(), 64, output);
         }
+    }
+    
+    bool Decoder::decodeMCURow(ScanPosition& position,
+                               const int firstMCU,
+                               const int count,
+                               const std::size_t intervalCount,
+                               MCU* MCUs) const
+    {
+        bool valid = true;
         
-        logFile << "Byte stuffing image scan data..." << std::endl;
-        
-        for (unsigned i = 0; i <= m_scanData.size() - 8; i += 8)
+        for (auto i = 0; i < count; ++i)
         {
-            std::string byte = m_scanData.substr(i, 8);
+            // The last interval takes any MCUs left over by missing restart markers
+            std::size_t interval = m_restartInterval > 0 ? (firstMCU + i) / m_restartInterval : 0;
+            
+            if (interval != position.interval && interval < intervalCount)
+                startRestartInterval(position, interval, intervalCount);
             
-            if (byte == "11111111")
+            for (std::size_t block = 0; block < m_blockComponents.size(); ++block)
             {
-                if (i + 8 < m_scanData.size() - 8)
+                int compID = m_blockComponents[block];
+                CoefficientBlock& coeffs = MCUs[i].getCoefficients(block);
+                
+                // The rest of a corrupt restart interval is left blank, the
+                // MCUs still hold the coefficients of the previous row
+                if (position.corrupt)
+                {
+                    coeffs.coeffs.fill(0);
+                    coeffs.lastNonZero = 0;
+                }
+                else if (!decodeBlock(position.reader, compID, position.DCPredictor[compID], coeffs))
                 {
-                    std::string nextByte = m_scanData.substr(i + 8, 8);
-                    
-                    if (nextByte == "00000000")
-                    {
-                        m_scanData.erase(i + 8, 8);
-                    }
-                    else continue;
+                    position.corrupt = true;
+                    valid = false;
                 }
-                else
-                    continue;
             }
         }
         
-        logFile << "Finished byte stuffing image scan data [OK]" << std::endl;
+        return valid;
     }
     
-    void Decoder::decodeScanData()
+    bool Decoder::decodeRestartInterval(const UInt8* data,
+                                        const std::size_t size,
+                                        const int firstMCU,
+                                        const int endMCU)
     {
-        if (m_scanData.empty())
+        BitReader reader(data, size);
+        int DCPredictor[3] = { 0, 0, 0 };
+        
+        for (auto i = firstMCU; i < endMCU; ++i)
         {
-            logFile << " [ FATAL ] Invalid image scan data" << std::endl;
-            return;
+            // Decode the blocks of each component Y, Cb & Cr
+            // straight into the MCU's coefficient blocks
+            for (std::size_t block = 0; block < m_blockComponents.size(); ++block)
+            {
+                int compID = m_blockComponents[block];
+                
+                if (!decodeBlock(reader, compID, DCPredictor[compID], m_MCU[i].getCoefficients(block)))
+                    return false;
+            }
         }
         
-        byteStuffScanData();
+        return true;
+    }
+    
+    bool Decoder::decodeSpeculatively(const int MCUCount, const unsigned threads)
+    {
+        // Chunks are kept long compared to the distance the
+        // decoders typically need to synchronize, a few blocks
+        const std::size_t MIN_CHUNK_BITS = 8 * 16384;
         
-        logFile << "Decoding image scan data..." << std::endl;
+        const int blocksPerMCU = m_blockComponents.size();
+        const std::size_t totalBlocks = std::size_t(MCUCount) * blocksPerMCU;
+        const std::size_t totalBits = m_scanData.size() * 8;
         
-        const char* component[] = { "Y (Luminance)", "Cb (Chrominance)", "Cr (Chrominance)" };
-        const char* type[] = { "DC", "AC" };        
+        // Use a few chunks per thread to balance the load
+        std::size_t chunkCount = std::min<std::size_t>(threads * 4, totalBits / MIN_CHUNK_BITS);
         
-        int MCUCount = (m_image.width * m_image.height) / 64;
+        if (chunkCount < 2)
+            return decodeRestartInterval(m_scanData.data(), m_scanData.size(), 0, MCUCount);
         
-        m_MCU.clear();
-        logFile << "MCU count: " << MCUCount << std::endl;
+        const std::size_t chunkBits = totalBits / chunkCount;
+        auto chunkEnd = [&](const std::size_t chunk)
+        {
+            return chunk + 1 == chunkCount ? totalBits : (chunk + 1) * chunkBits;
+        };
+        
+        // Where the decoder of each chunk crossed into the next chunk, and
+        // the block boundaries it passed on the way there. The number of
+        // blocks is counted from the start of the chunk.
+        std::vector<BlockBoundary> exits(chunkCount);
+        std::vector<std::vector<BlockBoundary>> paths(chunkCount);
+        
+        // Number of blocks in each chunk, once its entry is known
+        std::vector<std::size_t> blockCounts(chunkCount, 0);
+        
+        // Phase 1: decode each chunk from a guessed starting point, a block
+        // starting at the first bit of the chunk. The guess is right for
+        // the first chunk only, but a wrong guess usually runs into the
+        // real block boundaries after a few blocks. The last chunk's exit
+        // isn't needed.
+        utils::parallelFor(chunkCount - 1, threads, [&](const std::size_t chunk)
+        {
+            BlockBoundary guess = { chunk * chunkBits, 0, 0 };
+            int match;
+            
+            exits[chunk] = skipBlocks(guess, chunkEnd(chunk), &paths[chunk], nullptr, match);
+        });
+        
+        // Phase 2: decode each chunk again, from the previous chunk's exit,
+        // until reaching a block boundary on the chunk's own path. From
+        // there on the first decode was right, along with its exit. If it
+        // never was, the exit changes and the next chunk has to be checked
+        // again in the next round. The first chunk's exit is always right.
+        std::vector<char> pending(chunkCount - 1, 1);
+        pending[0] = 0;
+        blockCounts[0] = exits[0].blockCount;
         
-        int k = 0; // The index of the next bit to be scanned
+        int rounds = 0;
         
-        for (auto i = 0; i < MCUCount; ++i)
+        while (std::find(pending.begin(), pending.end(), 1) != pending.end())
         {
-            logFile << "Decoding MCU-" << i + 1 << "..." << std::endl;
-            
-            // The run-length coding after decoding the Huffman data
-            std::array<std::vector<int>, 3> RLE;            
-            
-            // For each component Y, Cb & Cr, decode 1 DC
-            // coefficient and then decode 63 AC coefficients.
-            //
-            // NOTE:
-            // Since a signnificant portion of a RLE for a
-            // component contains a trail of 0s, AC coefficients
-            // are decoded till, either an EOB (End of block) is
-            // encountered or 63 AC coefficients have been decoded.
+            std::vector<BlockBoundary> entries(exits);
+            std::vector<char> changed(chunkCount - 1, 0);
             
-            for (auto compID = 0; compID < 3; ++compID)
+            utils::parallelFor(chunkCount - 2, threads, [&](const std::size_t i)
             {
-                std::string bitsScanned = ""; // Initially no bits are scanned
+                std::size_t chunk = i + 1;
                 
-                // Firstly, decode the DC coefficient
-                logFile << "Decoding MCU-" << i + 1 << ": " << component[compID] << "/" << type[HT_DC] << std::endl;
+                if (!pending[chunk])
+                    return;
                 
-                int HuffTableID = compID == 0 ? 0 : 1;
+                BlockBoundary entry = { entries[chunk - 1].bitPosition, 0, entries[chunk - 1].blockInMCU };
+                std::vector<BlockBoundary> path;
+                int match;
                 
-                while (1)
-                {       
-                    bitsScanned += m_scanData[k];
-                    auto value = m_huffmanTree[HT_DC][HuffTableID].contains(bitsScanned);
-                    
-                    if (!utils::isStringWhiteSpace(value))
-                    {
-                        if (value != "EOB")
-                        {   
-                            int zeroCount = UInt8(std::stoi(value)) >> 4 ;
-                            int category = UInt8(std::stoi(value)) & 0x0F;
-                            int DCCoeff = bitStringtoValue(m_scanData.substr(k + 1, category));
-                            
-                            k += category + 1;
-                            bitsScanned = "";
-                            
-                            RLE[compID].push_back(zeroCount);
-                            RLE[compID].push_back(DCCoeff);
-                            
-                            break;
-                        }
-                        
-                        else
-                        {
-                            bitsScanned = "";
-                            k++;
-                            
-                            RLE[compID].push_back(0);
-                            RLE[compID].push_back(0);
-                            
-                            break;
-                        }
-                    }
-                    else
-                        k++;
+                BlockBoundary exit = skipBlocks(entry, chunkEnd(chunk), &path, &paths[chunk], match);
+                
+                if (match >= 0)
+                {
+                    // Synchronized, only the number of blocks changes
+                    blockCounts[chunk] = exit.blockCount + exits[chunk].blockCount - paths[chunk][match].blockCount;
+                    return;
                 }
                 
-                // Then decode the AC coefficients
-                logFile << "Decoding MCU-" << i + 1 << ": " << component[compID] << "/" << type[HT_AC] << std::endl;
-                bitsScanned = "";
-                int ACCodesCount = 0;
-                                
-                while (1)
-                {   
-                    // If 63 AC codes have been encountered, this block is done, move onto next block                    
-                    if (ACCodesCount  == 63)
-                    {
-                        break;
-                    }
-                    
-                    // Append the k-th bit to the bits scanned so far
-                    bitsScanned += m_scanData[k];
-                    auto value = m_huffmanTree[HT_AC][HuffTableID].contains(bitsScanned);
-                    
-                    if (!utils::isStringWhiteSpace(value))
-                    {
-                        if (value != "EOB")
-                        {
-                            int zeroCount = UInt8(std::stoi(value)) >> 4 ;
-                            int category = UInt8(std::stoi(value)) & 0x0F;
-                            int ACCoeff = bitStringtoValue(m_scanData.substr(k + 1, category));
-                            
-                            k += category + 1;
-                            bitsScanned = "";
-                            
-                            RLE[compID].push_back(zeroCount);
-                            RLE[compID].push_back(ACCoeff);
-                            
-                            ACCodesCount += zeroCount + 1;
-                        }
-                        
-                        else
-                        {
-                            bitsScanned = "";
-                            k++;
-                            
-                            RLE[compID].push_back(0);
-                            RLE[compID].push_back(0);
-                            
-                            break;
-                        }
-                    }
-                    
-                    else
-                        k++;
+                changed[chunk] = exit.bitPosition != exits[chunk].bitPosition ||
+                                 exit.blockInMCU != exits[chunk].blockInMCU;
+                
+                blockCounts[chunk] = exit.blockCount;
+                exits[chunk] = exit;
+                paths[chunk].swap(path);
+            });
+            
+            for (std::size_t chunk = 1; chunk < chunkCount - 1; ++chunk)
+                pending[chunk] = changed[chunk - 1];
+            
+            rounds++;
+        }
+        
+        logFile << "Speculative decoding of " << chunkCount << " chunks synchronized after " << rounds << " rounds" << std::endl;
+        
+        // Phase 3: decode each chunk from its known entry, into the blocks
+        // following the ones decoded by the previous chunks. The DC
+        // predictions start at zero, so the DC coefficients are off by the
+        // sum of the DC differences in the previous chunks.
+        std::vector<std::size_t> firstBlock(chunkCount, 0);
+        
+        for (std::size_t chunk = 1; chunk < chunkCount; ++chunk)
+            firstBlock[chunk] = firstBlock[chunk - 1] + blockCounts[chunk - 1];
+        
+        std::vector<std::array<int, 3>> DCSums(chunkCount);
+        std::atomic<bool> corrupt(false);
+        
+        utils::parallelFor(chunkCount, threads, [&](const std::size_t chunk)
+        {
+            std::size_t endBlock = chunk + 1 == chunkCount ? totalBlocks : std::min(totalBlocks, firstBlock[chunk + 1]);
+            
+            BitReader reader(m_scanData.data(), m_scanData.size());
+            reader.seek(chunk == 0 ? 0 : exits[chunk - 1].bitPosition);
+            
+            int DCPredictor[3] = { 0, 0, 0 };
+            
+            for (std::size_t block = firstBlock[chunk]; block < endBlock; ++block)
+            {
+                int blockInMCU = block % blocksPerMCU;
+                int compID = m_blockComponents[blockInMCU];
+                
+                if (!decodeBlock(reader, compID, DCPredictor[compID], m_MCU[block / blocksPerMCU].getCoefficients(blockInMCU)))
+                {
+                    corrupt = true;
+                    break;
                 }
+            }
+            
+            std::copy(std::begin(DCPredictor), std::end(DCPredictor), DCSums[chunk].begin());
+        });
+        
+        // Prefix pass: add the DC differences of all previous chunks
+        std::vector<std::array<int, 3>> DCOffsets(chunkCount, { 0, 0, 0 });
+        
+        for (std::size_t chunk = 1; chunk < chunkCount; ++chunk)
+            for (auto compID = 0; compID < 3; ++compID)
+                DCOffsets[chunk][compID] = DCOffsets[chunk - 1][compID] + DCSums[chunk - 1][compID];
+        
+        utils::parallelFor(chunkCount - 1, threads, [&](const std::size_t i)
+        {
+            std::size_t chunk = i + 1;
+            std::size_t endBlock = chunk + 1 == chunkCount ? totalBlocks : std::min(totalBlocks, firstBlock[chunk + 1]);
+            
+            for (std::size_t block = firstBlock[chunk]; block < endBlock; ++block)
+            {
+                int blockInMCU = block % blocksPerMCU;
+                int compID = m_blockComponents[blockInMCU];
+                Int16& DC = m_MCU[block / blocksPerMCU].getCoefficients(blockInMCU).coeffs[0];
+                
+                DC = Int16(DC + DCOffsets[chunk][compID]);
+            }
+        });
+        
+        return !corrupt;
+    }
+    
+    Decoder::BlockBoundary Decoder::skipBlocks(const BlockBoundary& start,
+                                               const std::size_t endBit,
+                                               std::vector<BlockBoundary>* path,
+                                               const std::vector<BlockBoundary>* reference,
+                                               int& match) const
+    {
+        // Only the start of a path is kept, decoders that don't
+        // synchronize within it are very unlikely to do so later
+        const std::size_t MAX_PATH_LENGTH = 4096;
+        
+        const int blocksPerMCU = m_blockComponents.size();
+        
+        BitReader reader(m_scanData.data(), m_scanData.size());
+        reader.seek(start.bitPosition);
+        
+        CoefficientBlock block;
+        int DCPredictor = 0;
+        
+        BlockBoundary current = start;
+        std::size_t next = 0;
+        match = -1;
+        
+        while (current.bitPosition < endBit)
+        {
+            if (reference != nullptr)
+            {
+                // Both paths are in increasing order of bit position
+                while (next < reference->size() && (*reference)[next].bitPosition < current.bitPosition)
+                    next++;
                 
-                // If both the DC and AC coefficients are EOB, truncate to (0,0)
-                if (RLE[compID].size() == 2)
+                if (next < reference->size() &&
+                    (*reference)[next].bitPosition == current.bitPosition &&
+                    (*reference)[next].blockInMCU == current.blockInMCU)
                 {
-                    bool allZeros = true;
-                    
-                    for (auto&& rVal : RLE[compID])
-                    {
-                        if (rVal != 0)
-                        {
-                            allZeros = false;
-                            break;
-                        }
-                    }
-                    
-                    // Remove the extra (0,0) pair
-                    if (allZeros)
-                    {
-                        RLE[compID].pop_back();
-                        RLE[compID].pop_back();
-                    }
+                    match = next;
+                    return current;
                 }
             }
             
-            // Construct the MCU block from the RLE &
-            // quantization tables to a 8x8 matrix
-            m_MCU.push_back(MCU(RLE, m_QTables));
+            if (path != nullptr && path->size() < MAX_PATH_LENGTH)
+                path->push_back(current);
+            
+            if (decodeBlock(reader, m_blockComponents[current.blockInMCU], DCPredictor, block))
+            {
+                current.blockCount++;
+                current.blockInMCU = (current.blockInMCU + 1) % blocksPerMCU;
+            }
+            else
+            {
+                // Not a valid code, either a wrong guess or corrupt
+                // data, try again starting from the next bit
+                reader.seek(current.bitPosition + 1);
+            }
             
-            logFile << "Finished decoding MCU-" << i + 1 << " [OK]" << std::endl;
+            current.bitPosition = reader.bitPosition();
         }
         
-        // The remaining bits, if any, in the scan data are discarded as
-        // they're added byte align the scan data.
+        return current;
+    }
+    
+    bool Decoder::decodeBlock(BitReader& reader,
+                              const int compID,
+                              int& DCPredictor,
+                              CoefficientBlock& block) const
+    {
+        const Component& component = m_components[compID];
+        const HuffmanDecoder* DCDecoder = m_huffmanDecoder[HT_DC][component.DCTableID].get();
+        const HuffmanDecoder* ACDecoder = m_huffmanDecoder[HT_AC][component.ACTableID].get();
         
-        logFile << "Finished decoding image scan data [OK]" << std::endl;
+        if (DCDecoder == nullptr || ACDecoder == nullptr)
+            return false;
+        
+        block.coeffs.fill(0);
+        block.lastNonZero = 0;
+        
+        // Firstly, decode the DC coefficient
+        //
+        // The DC symbol is the category (bit length) of the
+        // difference from the DC coefficient of the previous block
+        int symbol = DCDecoder->decodeSymbol(reader);
+        
+        if (symbol < 0)
+            return false;
+        
+        DCPredictor += reader.receiveExtend(symbol & 0x0F);
+        block.coeffs[0] = Int16(DCPredictor);
+        
+        // Then decode the AC coefficients, till either an EOB (End of
+        // block) is encountered or 63 AC coefficients have been decoded.
+        for (auto k = 1; k < 64; ++k)
+        {
+            symbol = ACDecoder->decodeSymbol(reader);
+            
+            if (symbol < 0)
+                return false;
+            
+            int zeroCount = symbol >> 4;
+            int category = symbol & 0x0F;
+            
+            if (category == 0)
+            {
+                // End of block, the remaining AC coefficients are all zero
+                if (zeroCount != 15)
+                    break;
+                
+                // Run of 16 zeros (ZRL)
+                k += 15;
+                continue;
+            }
+            
+            k += zeroCount;
+            
+            if (k > 63)
+                return false;
+            
+            block.coeffs[ZIGZAG_TO_NATURAL[k]] = Int16(reader.receiveExtend(category));
+            block.lastNonZero = k;
+        }
+        
+        return true;
     }
 }
@@ -0,0 +1,127 @@
+// Implementaion of the Huffman decoder abstraction
+
+#include <string>
+#include <mutex>
+#include <unordered_map>
+
+#include "HuffmanDecoder.hpp"
+#include "Utility.hpp"
+
+namespace kpeg
+{
+    HuffmanDecoder::HuffmanDecoder()
+    {
+        m_lookup.fill( 0 );
+        m_maxCode.fill( -1 );
+        m_valOffset.fill( 0 );
+        m_symbols.fill( 0 );
+    }
+    
+    bool HuffmanDecoder::constructDecoder( const HuffmanTable& htable )
+    {
+        m_lookup.fill( 0 );
+        m_maxCode.fill( -1 );
+        m_valOffset.fill( 0 );
+        
+        // Codes are assigned in canonical order, i.e., codes of the
+        // same length are consecutive integers and the first code of
+        // length l + 1 is twice the code following the last one of length l
+        int code = 0;
+        int symbolCount = 0;
+        
+        for ( auto length = 1; length <= 16; ++length )
+        {
+            const auto& symbols = htable[length - 1].second;
+            
+            // The all ones 16-bit code is reserved, ITU-T.81 section C,
+            // the code space must have room left for it
+            int codeSpace = length == 16 ? ( 1 << length ) - 1 : ( 1 << length );
+            
+            if ( code + (int)symbols.size() > codeSpace ||
+                 symbolCount + (int)symbols.size() > (int)m_symbols.size() )
+                return false;
+            
+            m_valOffset[length] = symbolCount - code;
+            
+            for ( auto&& symbol : symbols )
+            {
+                // Every HUFF_LOOKUP_BITS wide bit pattern starting
+                // with this code decodes to the same symbol
+                if ( length <= HUFF_LOOKUP_BITS )
+                {
+                    int shift = HUFF_LOOKUP_BITS - length;
+                    
+                    for ( auto fill = 0; fill < ( 1 << shift ); ++fill )
+                        m_lookup[( code << shift ) | fill] = UInt16( length << 8 | symbol );
+                }
+                
+                m_symbols[symbolCount++] = symbol;
+                code++;
+            }
+            
+            if ( !symbols.empty() )
+                m_maxCode[length] = code - 1;
+            
+            code <<= 1;
+        }
+        
+        return true;
+    }
+    
+    std::shared_ptr<const HuffmanDecoder> getHuffmanDecoder( const HuffmanTable& htable )
+    {
+        // Upper bound on the number of cached decoders, so a long running
+        // process seeing many different encoders doesn't grow without bound
+        const std::size_t MAX_CACHED_DECODERS = 64;
+        
+        static std::mutex cacheMutex;
+        static std::unordered_map<std::string, std::shared_ptr<const HuffmanDecoder>> cache;
+        
+        // The key is the table as stored in the DHT segment:
+        // the 16 code counts followed by the symbols, at most 256 of them.
+        // Building it reuses the memory of the thread's previous key
+        static thread_local std::string key;
+        key.reserve( 16 + 256 );
+        key.assign( 16, '\0' );
+        
+        for ( auto i = 0; i < 16; ++i )
+        {
+            key[i] = char( htable[i].second.size() );
+            key.append( htable[i].second.begin(), htable[i].second.end() );
+        }
+        
+        {
+            std::lock_guard<std::mutex> lock( cacheMutex );
+            auto it = cache.find( key );
+            
+            if ( it != cache.end() )
+            {
+                logFile << "Reusing cached Huffman decoder [OK]" << std::endl;
+                return it->second;
+            }
+        }
+        
+        logFile << "Constructing Huffman decoder with specified Huffman table..." << std::endl;
+        
+        auto decoder = std::make_shared<HuffmanDecoder>();
+        
+        if ( !decoder->constructDecoder( htable ) )
+        {
+            logFile << "[ FATAL ] Invalid Huffman table, code counts overflow the code space!" << std::endl;
+            return nullptr;
+        }
+        
+        {
+            std::lock_guard<std::mutex> lock( cacheMutex );
+            
+            if ( cache.size() >= MAX_CACHED_DECODERS )
+                cache.clear();
+            
+            cache.emplace( key, decoder );
+        }
+        
+        logFile << "Finished building Huffman decoder [OK]" << std::endl;
+        
+        return decoder;
+    }
+}
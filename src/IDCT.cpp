@@ -0,0 +1,436 @@
+/// Inverse discrete cosine transform module implementation
+
+#include <cmath>
+#include <cstring>
+#include <array>
+#include <string>
+#include <cstdlib>
+#include <algorithm>
+
+#include "IDCT.hpp"
+#include "Transform.hpp"
+#include "Utility.hpp"
+
+namespace kpeg
+{
+    /// Clamp a level shifted sample to the sample range
+    static inline UInt8 clampSample(const int value)
+    {
+        return UInt8(std::max(0, std::min(value, 255)));
+    }
+    
+    /// Table of C(u) * cos((2x + 1)uπ/16) / 2, indexed by [u][x]
+    static const std::array<std::array<float, 8>, 8>& cosineTable()
+    {
+        static const std::array<std::array<float, 8>, 8> table = []
+        {
+            std::array<std::array<float, 8>, 8> t;
+            
+            for (int u = 0; u < 8; ++u)
+            {
+                double Cu = u == 0 ? 1.0 / std::sqrt(2.0) : 1.0;
+                
+                for (int x = 0; x < 8; ++x)
+                    t[u][x] = float(0.5 * Cu * std::cos((2 * x + 1) * u * M_PI / 16.0));
+            }
+            
+            return t;
+        }();
+        
+        return table;
+    }
+    
+    void prepareDequantizationTable(const std::vector<UInt16>& QTable, DequantizationTable& table)
+    {
+        for (int k = 0; k < 64; ++k)
+        {
+            int index = ZIGZAG_TO_NATURAL[k];
+            
+            table.integerFactors[index] = QTable[k];
+            table.floatFactors[index] = QTable[k] * 0.125f;
+        }
+    }
+    
+    void idctFloatReference(const CoefficientBlock& block, const DequantizationTable& table, UInt8* output, const std::size_t stride)
+    {
+        const auto& cosine = cosineTable();
+        
+        for (int y = 0; y < 8; ++y)
+        {
+            for (int x = 0; x < 8; ++x)
+            {
+                float sum = 0.0;
+                
+                for (int v = 0; v < 8; ++v)
+                {
+                    for (int u = 0; u < 8; ++u)
+                        sum += block.coeffs[v * 8 + u] * table.integerFactors[v * 8 + u] * cosine[v][y] * cosine[u][x];
+                }
+                
+                output[y * stride + x] = clampSample(int(std::round(sum)) + 128);
+            }
+        }
+    }
+    
+    // Fixed-point constants of the LLM factorization, scaled by 2^13
+    static const int CONST_BITS = 13;
+    
+    // Extra fractional bits kept between the column and the row pass
+    static const int PASS1_BITS = 2;
+    
+    static const int FIX_0_298631336 = 2446;
+    static const int FIX_0_390180644 = 3196;
+    static const int FIX_0_541196100 = 4433;
+    static const int FIX_0_765366865 = 6270;
+    static const int FIX_0_899976223 = 7373;
+    static const int FIX_1_175875602 = 9633;
+    static const int FIX_1_501321110 = 12299;
+    static const int FIX_1_847759065 = 15137;
+    static const int FIX_1_961570560 = 16069;
+    static const int FIX_2_053119869 = 16819;
+    static const int FIX_2_562915447 = 20995;
+    static const int FIX_3_072711026 = 25172;
+    
+    /// Divide by 2^bits, rounding to nearest
+    static inline int descale(const int value, const int bits)
+    {
+        return (value + (1 << (bits - 1))) >> bits;
+    }
+    
+    /// 1D IDCT of 8 values, spaced step apart in the input
+    ///
+    /// Only the first INPUTS values are read, the others are known to be
+    /// zero and their terms drop out. The output is scaled up by
+    /// 2^CONST_BITS, and by sqrt(8) compared to the orthonormal 1D IDCT.
+    template <int INPUTS>
+    static inline void idct1D(const int* in, const int step, int out[8])
+    {
+        auto input = [&](const int k) { return k < INPUTS ? in[k * step] : 0; };
+        
+        // Even part, from the coefficients 0, 2, 4 and 6
+        int z2 = input(2);
+        int z3 = input(6);
+        
+        int z1 = (z2 + z3) * FIX_0_541196100;
+        int tmp2 = z1 - z3 * FIX_1_847759065;
+        int tmp3 = z1 + z2 * FIX_0_765366865;
+        
+        int tmp0 = (input(0) + input(4)) * (1 << CONST_BITS);
+        int tmp1 = (input(0) - input(4)) * (1 << CONST_BITS);
+        
+        int tmp10 = tmp0 + tmp3;
+        int tmp13 = tmp0 - tmp3;
+        int tmp11 = tmp1 + tmp2;
+        int tmp12 = tmp1 - tmp2;
+        
+        // Odd part, from the coefficients 1, 3, 5 and 7
+        tmp0 = input(7);
+        tmp1 = input(5);
+        tmp2 = input(3);
+        tmp3 = input(1);
+        
+        z1 = tmp0 + tmp3;
+        z2 = tmp1 + tmp2;
+        z3 = tmp0 + tmp2;
+        int z4 = tmp1 + tmp3;
+        int z5 = (z3 + z4) * FIX_1_175875602;
+        
+        tmp0 *= FIX_0_298631336;
+        tmp1 *= FIX_2_053119869;
+        tmp2 *= FIX_3_072711026;
+        tmp3 *= FIX_1_501321110;
+        z1 *= -FIX_0_899976223;
+        z2 *= -FIX_2_562915447;
+        z3 = z3 * -FIX_1_961570560 + z5;
+        z4 = z4 * -FIX_0_390180644 + z5;
+        
+        tmp0 += z1 + z3;
+        tmp1 += z2 + z4;
+        tmp2 += z2 + z3;
+        tmp3 += z1 + z4;
+        
+        out[0] = tmp10 + tmp3;
+        out[7] = tmp10 - tmp3;
+        out[1] = tmp11 + tmp2;
+        out[6] = tmp11 - tmp2;
+        out[2] = tmp12 + tmp1;
+        out[5] = tmp12 - tmp1;
+        out[3] = tmp13 + tmp0;
+        out[4] = tmp13 - tmp0;
+    }
+    
+    /// Fixed-point IDCT of a block whose non-zero coefficients
+    /// are all in its top left SIZE x SIZE corner
+    template <int SIZE>
+    static void idctIntegerBlock(const CoefficientBlock& block, const DequantizationTable& table, UInt8* output, const std::size_t stride)
+    {
+        const Int16* in = block.coeffs.data();
+        const int* factors = table.integerFactors.data();
+        int workspace[64] = {};
+        int column[8];
+        int values[8];
+        
+        // Pass 1: columns, the results keep PASS1_BITS fractional bits
+        for (int x = 0; x < SIZE; ++x)
+        {
+            bool hasAC = false;
+            
+            for (int v = 1; v < SIZE; ++v)
+                hasAC |= in[v * 8 + x] != 0;
+            
+            // With no AC coefficients in the column, all its values equal the DC
+            if (!hasAC)
+            {
+                int dc = in[x] * factors[x] * (1 << PASS1_BITS);
+                
+                for (int y = 0; y < 8; ++y)
+                    workspace[y * 8 + x] = dc;
+                
+                continue;
+            }
+            
+            // De-quantize the column
+            for (int v = 0; v < SIZE; ++v)
+                column[v] = in[v * 8 + x] * factors[v * 8 + x];
+            
+            idct1D<SIZE>(column, 1, values);
+            
+            for (int y = 0; y < 8; ++y)
+                workspace[y * 8 + x] = descale(values[y], CONST_BITS - PASS1_BITS);
+        }
+        
+        // Pass 2: rows, removing the fixed-point scaling and the
+        // factor 8 the two passes add compared to the 2D IDCT
+        for (int y = 0; y < 8; ++y)
+        {
+            idct1D<SIZE>(workspace + y * 8, 1, values);
+            
+            UInt8* row = output + y * stride;
+            
+            for (int x = 0; x < 8; ++x)
+                row[x] = clampSample(descale(values[x], CONST_BITS + PASS1_BITS + 3) + 128);
+        }
+    }
+    
+    void idctInteger(const CoefficientBlock& block, const DequantizationTable& table, UInt8* output, const std::size_t stride)
+    {
+        idctIntegerBlock<8>(block, table, output, stride);
+    }
+    
+    void idctIntegerTopLeft(const CoefficientBlock& block, const DequantizationTable& table, UInt8* output, const std::size_t stride)
+    {
+        idctIntegerBlock<4>(block, table, output, stride);
+    }
+    
+    void idctDCOnly(const CoefficientBlock& block, const DequantizationTable& table, UInt8* output, const std::size_t stride)
+    {
+        // All 64 samples are DC / 8
+        UInt8 sample = clampSample(descale(block.coeffs[0] * table.integerFactors[0], 3) + 128);
+        
+        for (int y = 0; y < 8; ++y)
+            std::memset(output + y * stride, sample, 8);
+    }
+    
+    /// Fixed-point table of C(u) * cos((2x + 1)uπ / 2SIZE) / 2, indexed by [x][u]
+    ///
+    /// The SIZE samples are the samples of the full 8-point IDCT at
+    /// the centers of groups of 8 / SIZE samples.
+    template <int SIZE>
+    static const std::array<std::array<int, SIZE>, SIZE>& scaledCosineTable()
+    {
+        static const std::array<std::array<int, SIZE>, SIZE> table = []
+        {
+            std::array<std::array<int, SIZE>, SIZE> t;
+            
+            for (int x = 0; x < SIZE; ++x)
+            {
+                for (int u = 0; u < SIZE; ++u)
+                {
+                    double Cu = u == 0 ? 1.0 / std::sqrt(2.0) : 1.0;
+                    double value = 0.5 * Cu * std::cos((2 * x + 1) * u * M_PI / (2.0 * SIZE));
+                    t[x][u] = int(std::lround(value * (1 << CONST_BITS)));
+                }
+            }
+            
+            return t;
+        }();
+        
+        return table;
+    }
+    
+    /// Scaled IDCT, SIZE x SIZE samples from the top left SIZE x SIZE coefficients
+    template <int SIZE>
+    static void idctScaledBlock(const CoefficientBlock& block, const DequantizationTable& table, UInt8* output, const std::size_t stride)
+    {
+        if (SIZE == 1 || block.lastNonZero == 0)
+        {
+            UInt8 sample = clampSample(descale(block.coeffs[0] * table.integerFactors[0], 3) + 128);
+            
+            for (int y = 0; y < SIZE; ++y)
+                std::memset(output + y * stride, sample, SIZE);
+            
+            return;
+        }
+        
+        const auto& cosine = scaledCosineTable<SIZE>();
+        int workspace[SIZE][SIZE];
+        
+        // Pass 1: columns, the results keep PASS1_BITS fractional bits
+        for (int u = 0; u < SIZE; ++u)
+        {
+            for (int y = 0; y < SIZE; ++y)
+            {
+                int sum = 0;
+                
+                for (int v = 0; v < SIZE; ++v)
+                    sum += cosine[y][v] * block.coeffs[v * 8 + u] * table.integerFactors[v * 8 + u];
+                
+                workspace[y][u] = descale(sum, CONST_BITS - PASS1_BITS);
+            }
+        }
+        
+        // Pass 2: rows
+        for (int y = 0; y < SIZE; ++y)
+        {
+            UInt8* row = output + y * stride;
+            
+            for (int x = 0; x < SIZE; ++x)
+            {
+                int sum = 0;
+                
+                for (int u = 0; u < SIZE; ++u)
+                    sum += cosine[x][u] * workspace[y][u];
+                
+                row[x] = clampSample(descale(sum, CONST_BITS + PASS1_BITS) + 128);
+            }
+        }
+    }
+    
+    void idctScaled4x4(const CoefficientBlock& block, const DequantizationTable& table, UInt8* output, const std::size_t stride)
+    {
+        idctScaledBlock<4>(block, table, output, stride);
+    }
+    
+    void idctScaled2x2(const CoefficientBlock& block, const DequantizationTable& table, UInt8* output, const std::size_t stride)
+    {
+        idctScaledBlock<2>(block, table, output, stride);
+    }
+    
+    void idctScaled1x1(const CoefficientBlock& block, const DequantizationTable& table, UInt8* output, const std::size_t stride)
+    {
+        idctScaledBlock<1>(block, table, output, stride);
+    }
+    
+    /// IDCT picking the cheapest kernel for the coefficients that can be
+    /// non-zero, from the zig-zag index of the last non-zero coefficient
+    ///
+    /// Smooth image areas mostly have blocks with only a DC coefficient,
+    /// or only a few low frequency ones.
+    template <IDCTFunction FULL, IDCTFunction TOP_LEFT>
+    static void idctSparse(const CoefficientBlock& block, const DequantizationTable& table, UInt8* output, const std::size_t stride)
+    {
+        if (block.lastNonZero == 0)
+            idctDCOnly(block, table, output, stride);
+        else if (block.lastNonZero <= IDCT_TOP_LEFT_LAST_ZIGZAG)
+            TOP_LEFT(block, table, output, stride);
+        else
+            FULL(block, table, output, stride);
+    }
+    
+    const char* getIDCTKernelName(const IDCTKernel kernel)
+    {
+        switch (kernel)
+        {
+            case IDCT_AUTO            : return "auto";
+            case IDCT_FLOAT_REFERENCE : return "float";
+            case IDCT_INTEGER         : return "integer";
+            case IDCT_SSE2            : return "sse2";
+            case IDCT_AVX2            : return "avx2";
+        }
+        
+        return "unknown";
+    }
+    
+    bool isIDCTKernelSupported(const IDCTKernel kernel)
+    {
+        switch (kernel)
+        {
+            case IDCT_AUTO            :
+            case IDCT_FLOAT_REFERENCE :
+            case IDCT_INTEGER         : return true;
+#if defined(__SSE2__)
+            case IDCT_SSE2            : return true;
+#endif
+#if defined(KPEG_ENABLE_AVX2)
+            case IDCT_AVX2            : return utils::isAVX2Supported();
+#endif
+            default                   : return false;
+        }
+    }
+    
+    IDCTKernel getDefaultIDCTKernel()
+    {
+        // Decided once, the environment and the CPU don't change
+        static const IDCTKernel kernel = []
+        {
+            const char* forced = std::getenv("KPEG_IDCT");
+            
+            if (forced != nullptr)
+            {
+                std::string name = forced;
+                IDCTKernel requested = IDCT_AUTO;
+                
+                for (auto k : { IDCT_FLOAT_REFERENCE, IDCT_INTEGER, IDCT_SSE2, IDCT_AVX2 })
+                {
+                    if (name == getIDCTKernelName(k))
+                        requested = k;
+                }
+                
+                if (requested != IDCT_AUTO && isIDCTKernelSupported(requested))
+                    return requested;
+                
+                logFile << "IDCT kernel \'" << name << "\' from KPEG_IDCT is not available, ignoring it" << std::endl;
+            }
+            
+            if (isIDCTKernelSupported(IDCT_AVX2))
+                return IDCT_AVX2;
+            
+            if (isIDCTKernelSupported(IDCT_SSE2))
+                return IDCT_SSE2;
+            
+            return IDCT_INTEGER;
+        }();
+        
+        return kernel;
+    }
+    
+    IDCTFunction getIDCTFunction(const IDCTKernel kernel, const int size)
+    {
+        switch (size)
+        {
+            case 4  : return idctScaled4x4;
+            case 2  : return idctScaled2x2;
+            case 1  : return idctScaled1x1;
+            default : break;
+        }
+        
+        if (!isIDCTKernelSupported(kernel))
+        {
+            logFile << "IDCT kernel \'" << getIDCTKernelName(kernel) << "\' is not supported, using the integer IDCT" << std::endl;
+            return getIDCTFunction(IDCT_INTEGER);
+        }
+        
+        switch (kernel)
+        {
+            case IDCT_AUTO            : return getIDCTFunction(getDefaultIDCTKernel());
+            case IDCT_FLOAT_REFERENCE : return idctFloatReference;
+#if defined(__SSE2__)
+            case IDCT_SSE2            : return idctSparse<idctSSE2, idctSSE2TopLeft>;
+#endif
+#if defined(KPEG_ENABLE_AVX2)
+            case IDCT_AVX2            : return idctSparse<idctAVX2, idctAVX2TopLeft>;
+#endif
+            default                   : return idctSparse<idctInteger, idctIntegerTopLeft>;
+        }
+    }
+}
@@ -0,0 +1,194 @@
+/// AVX2 IDCT kernel
+///
+/// The LLM factorization in single precision floating point, with
+/// each 1D pass working on all eight columns of the block at once.
+///
+/// This is the only file built with AVX2 code generation, and its kernel
+/// is only called when the CPU supports AVX2. Keep it free of templates
+/// and inline functions that do real work and are shared with the other
+/// files: the linker could pick their AVX2 copies for older CPUs.
+
+#include "IDCT.hpp"
+
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+
+namespace kpeg
+{
+    /// 1D IDCT of 8 vectors of 8 lanes, one lane per column
+    ///
+    /// The output is scaled by sqrt(8) compared to the orthonormal 1D IDCT.
+    static inline void idct1D(const __m256 in[8], __m256 out[8])
+    {
+        // Even part, from the coefficients 0, 2, 4 and 6
+        __m256 z1 = _mm256_mul_ps(_mm256_add_ps(in[2], in[6]), _mm256_set1_ps(0.541196100f));
+        __m256 tmp2 = _mm256_sub_ps(z1, _mm256_mul_ps(in[6], _mm256_set1_ps(1.847759065f)));
+        __m256 tmp3 = _mm256_add_ps(z1, _mm256_mul_ps(in[2], _mm256_set1_ps(0.765366865f)));
+        
+        __m256 tmp0 = _mm256_add_ps(in[0], in[4]);
+        __m256 tmp1 = _mm256_sub_ps(in[0], in[4]);
+        
+        __m256 tmp10 = _mm256_add_ps(tmp0, tmp3);
+        __m256 tmp13 = _mm256_sub_ps(tmp0, tmp3);
+        __m256 tmp11 = _mm256_add_ps(tmp1, tmp2);
+        __m256 tmp12 = _mm256_sub_ps(tmp1, tmp2);
+        
+        // Odd part, from the coefficients 1, 3, 5 and 7
+        z1 = _mm256_add_ps(in[7], in[1]);
+        __m256 z2 = _mm256_add_ps(in[5], in[3]);
+        __m256 z3 = _mm256_add_ps(in[7], in[3]);
+        __m256 z4 = _mm256_add_ps(in[5], in[1]);
+        __m256 z5 = _mm256_mul_ps(_mm256_add_ps(z3, z4), _mm256_set1_ps(1.175875602f));
+        
+        tmp0 = _mm256_mul_ps(in[7], _mm256_set1_ps(0.298631336f));
+        tmp1 = _mm256_mul_ps(in[5], _mm256_set1_ps(2.053119869f));
+        tmp2 = _mm256_mul_ps(in[3], _mm256_set1_ps(3.072711026f));
+        tmp3 = _mm256_mul_ps(in[1], _mm256_set1_ps(1.501321110f));
+        z1 = _mm256_mul_ps(z1, _mm256_set1_ps(-0.899976223f));
+        z2 = _mm256_mul_ps(z2, _mm256_set1_ps(-2.562915447f));
+        z3 = _mm256_add_ps(_mm256_mul_ps(z3, _mm256_set1_ps(-1.961570560f)), z5);
+        z4 = _mm256_add_ps(_mm256_mul_ps(z4, _mm256_set1_ps(-0.390180644f)), z5);
+        
+        tmp0 = _mm256_add_ps(tmp0, _mm256_add_ps(z1, z3));
+        tmp1 = _mm256_add_ps(tmp1, _mm256_add_ps(z2, z4));
+        tmp2 = _mm256_add_ps(tmp2, _mm256_add_ps(z2, z3));
+        tmp3 = _mm256_add_ps(tmp3, _mm256_add_ps(z1, z4));
+        
+        out[0] = _mm256_add_ps(tmp10, tmp3);
+        out[7] = _mm256_sub_ps(tmp10, tmp3);
+        out[1] = _mm256_add_ps(tmp11, tmp2);
+        out[6] = _mm256_sub_ps(tmp11, tmp2);
+        out[2] = _mm256_add_ps(tmp12, tmp1);
+        out[5] = _mm256_sub_ps(tmp12, tmp1);
+        out[3] = _mm256_add_ps(tmp13, tmp0);
+        out[4] = _mm256_sub_ps(tmp13, tmp0);
+    }
+    
+    /// 1D IDCT of 8 vectors whose last four are zero
+    ///
+    /// The LLM factorization with the zero terms removed, the odd part
+    /// reduces to its four rotations by multiples of π/16.
+    static inline void idct1DHalf(const __m256 in[8], __m256 out[8])
+    {
+        // Even part, from the coefficients 0 and 2
+        __m256 even0 = _mm256_mul_ps(in[2], _mm256_set1_ps(1.306562965f));
+        __m256 even1 = _mm256_mul_ps(in[2], _mm256_set1_ps(0.541196100f));
+        
+        __m256 tmp10 = _mm256_add_ps(in[0], even0);
+        __m256 tmp13 = _mm256_sub_ps(in[0], even0);
+        __m256 tmp11 = _mm256_add_ps(in[0], even1);
+        __m256 tmp12 = _mm256_sub_ps(in[0], even1);
+        
+        // Odd part, from the coefficients 1 and 3
+        __m256 tmp3 = _mm256_add_ps(_mm256_mul_ps(in[1], _mm256_set1_ps(1.387039845f)), _mm256_mul_ps(in[3], _mm256_set1_ps(1.175875602f)));
+        __m256 tmp2 = _mm256_sub_ps(_mm256_mul_ps(in[1], _mm256_set1_ps(1.175875602f)), _mm256_mul_ps(in[3], _mm256_set1_ps(0.275899379f)));
+        __m256 tmp1 = _mm256_sub_ps(_mm256_mul_ps(in[1], _mm256_set1_ps(0.785694958f)), _mm256_mul_ps(in[3], _mm256_set1_ps(1.387039845f)));
+        __m256 tmp0 = _mm256_sub_ps(_mm256_mul_ps(in[1], _mm256_set1_ps(0.275899379f)), _mm256_mul_ps(in[3], _mm256_set1_ps(0.785694958f)));
+        
+        out[0] = _mm256_add_ps(tmp10, tmp3);
+        out[7] = _mm256_sub_ps(tmp10, tmp3);
+        out[1] = _mm256_add_ps(tmp11, tmp2);
+        out[6] = _mm256_sub_ps(tmp11, tmp2);
+        out[2] = _mm256_add_ps(tmp12, tmp1);
+        out[5] = _mm256_sub_ps(tmp12, tmp1);
+        out[3] = _mm256_add_ps(tmp13, tmp0);
+        out[4] = _mm256_sub_ps(tmp13, tmp0);
+    }
+    
+    /// Transpose an 8x8 matrix stored as its rows
+    static inline void transpose8x8(__m256 rows[8])
+    {
+        // Interleave pairs of rows, then pairs of pairs, within each 128-bit lane
+        __m256 t0 = _mm256_unpacklo_ps(rows[0], rows[1]);
+        __m256 t1 = _mm256_unpackhi_ps(rows[0], rows[1]);
+        __m256 t2 = _mm256_unpacklo_ps(rows[2], rows[3]);
+        __m256 t3 = _mm256_unpackhi_ps(rows[2], rows[3]);
+        __m256 t4 = _mm256_unpacklo_ps(rows[4], rows[5]);
+        __m256 t5 = _mm256_unpackhi_ps(rows[4], rows[5]);
+        __m256 t6 = _mm256_unpacklo_ps(rows[6], rows[7]);
+        __m256 t7 = _mm256_unpackhi_ps(rows[6], rows[7]);
+        
+        __m256 s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+        __m256 s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+        __m256 s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+        __m256 s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+        __m256 s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+        __m256 s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+        __m256 s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+        __m256 s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+        
+        // Swap the 128-bit lanes across the top and bottom halves
+        rows[0] = _mm256_permute2f128_ps(s0, s4, 0x20);
+        rows[1] = _mm256_permute2f128_ps(s1, s5, 0x20);
+        rows[2] = _mm256_permute2f128_ps(s2, s6, 0x20);
+        rows[3] = _mm256_permute2f128_ps(s3, s7, 0x20);
+        rows[4] = _mm256_permute2f128_ps(s0, s4, 0x31);
+        rows[5] = _mm256_permute2f128_ps(s1, s5, 0x31);
+        rows[6] = _mm256_permute2f128_ps(s2, s6, 0x31);
+        rows[7] = _mm256_permute2f128_ps(s3, s7, 0x31);
+    }
+    
+    /// IDCT of a block whose non-zero coefficients are all in its
+    /// top left SIZE x SIZE corner, SIZE is 4 or 8
+    template <int SIZE>
+    static inline void idctBlock(const CoefficientBlock& block, const DequantizationTable& table, UInt8* output, const std::size_t stride)
+    {
+        const __m128i* in = reinterpret_cast<const __m128i*>(block.coeffs.data());
+        const float* factors = table.floatFactors.data();
+        __m256 values[8], columns[8];
+        
+        auto transform = [](const __m256 src[8], __m256 dst[8])
+        {
+            if (SIZE == 4)
+                idct1DHalf(src, dst);
+            else
+                idct1D(src, dst);
+        };
+        
+        // Pass 1: columns, the rows of the block are the inputs, sign
+        // extended to 32 bits, converted and de-quantized on load
+        for (int v = 0; v < SIZE; ++v)
+        {
+            __m256i coeffs = _mm256_cvtepi16_epi32(_mm_load_si128(in + v));
+            values[v] = _mm256_mul_ps(_mm256_cvtepi32_ps(coeffs), _mm256_loadu_ps(factors + v * 8));
+        }
+        
+        transform(values, columns);
+        
+        // Pass 2: rows, transposed so the lanes are the rows of the block,
+        // the results are transposed back to rows of samples
+        transpose8x8(columns);
+        transform(columns, values);
+        transpose8x8(values);
+        
+        // Level shift, round and clamp, the factors removed the
+        // factor 8 the two passes add
+        const __m256 shift = _mm256_set1_ps(128.0f);
+        
+        for (int y = 0; y < 8; y += 2)
+        {
+            __m256i first = _mm256_cvtps_epi32(_mm256_add_ps(values[y], shift));
+            __m256i second = _mm256_cvtps_epi32(_mm256_add_ps(values[y + 1], shift));
+            
+            // Packing works within 128-bit lanes, reorder to the two rows one after the other
+            __m256i rows = _mm256_permute4x64_epi64(_mm256_packs_epi32(first, second), _MM_SHUFFLE(3, 1, 2, 0));
+            __m128i samples = _mm_packus_epi16(_mm256_castsi256_si128(rows), _mm256_extracti128_si256(rows, 1));
+            
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(output + y * stride), samples);
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(output + (y + 1) * stride), _mm_unpackhi_epi64(samples, samples));
+        }
+    }
+    
+    void idctAVX2(const CoefficientBlock& block, const DequantizationTable& table, UInt8* output, const std::size_t stride)
+    {
+        idctBlock<8>(block, table, output, stride);
+    }
+    
+    void idctAVX2TopLeft(const CoefficientBlock& block, const DequantizationTable& table, UInt8* output, const std::size_t stride)
+    {
+        idctBlock<4>(block, table, output, stride);
+    }
+}
+
+#endif // __AVX2__
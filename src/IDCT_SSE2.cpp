@@ -0,0 +1,195 @@
+/// SSE2 IDCT kernel
+///
+/// The LLM factorization in single precision floating point, with
+/// each 1D pass working on four columns of the block at a time.
+
+#include "IDCT.hpp"
+
+#if defined(__SSE2__)
+
+#include <emmintrin.h>
+
+namespace kpeg
+{
+    /// 1D IDCT of 8 vectors of 4 lanes, one lane per column
+    ///
+    /// The output is scaled by sqrt(8) compared to the orthonormal 1D IDCT.
+    static inline void idct1D(const __m128 in[8], __m128 out[8])
+    {
+        // Even part, from the coefficients 0, 2, 4 and 6
+        __m128 z1 = _mm_mul_ps(_mm_add_ps(in[2], in[6]), _mm_set1_ps(0.541196100f));
+        __m128 tmp2 = _mm_sub_ps(z1, _mm_mul_ps(in[6], _mm_set1_ps(1.847759065f)));
+        __m128 tmp3 = _mm_add_ps(z1, _mm_mul_ps(in[2], _mm_set1_ps(0.765366865f)));
+        
+        __m128 tmp0 = _mm_add_ps(in[0], in[4]);
+        __m128 tmp1 = _mm_sub_ps(in[0], in[4]);
+        
+        __m128 tmp10 = _mm_add_ps(tmp0, tmp3);
+        __m128 tmp13 = _mm_sub_ps(tmp0, tmp3);
+        __m128 tmp11 = _mm_add_ps(tmp1, tmp2);
+        __m128 tmp12 = _mm_sub_ps(tmp1, tmp2);
+        
+        // Odd part, from the coefficients 1, 3, 5 and 7
+        z1 = _mm_add_ps(in[7], in[1]);
+        __m128 z2 = _mm_add_ps(in[5], in[3]);
+        __m128 z3 = _mm_add_ps(in[7], in[3]);
+        __m128 z4 = _mm_add_ps(in[5], in[1]);
+        __m128 z5 = _mm_mul_ps(_mm_add_ps(z3, z4), _mm_set1_ps(1.175875602f));
+        
+        tmp0 = _mm_mul_ps(in[7], _mm_set1_ps(0.298631336f));
+        tmp1 = _mm_mul_ps(in[5], _mm_set1_ps(2.053119869f));
+        tmp2 = _mm_mul_ps(in[3], _mm_set1_ps(3.072711026f));
+        tmp3 = _mm_mul_ps(in[1], _mm_set1_ps(1.501321110f));
+        z1 = _mm_mul_ps(z1, _mm_set1_ps(-0.899976223f));
+        z2 = _mm_mul_ps(z2, _mm_set1_ps(-2.562915447f));
+        z3 = _mm_add_ps(_mm_mul_ps(z3, _mm_set1_ps(-1.961570560f)), z5);
+        z4 = _mm_add_ps(_mm_mul_ps(z4, _mm_set1_ps(-0.390180644f)), z5);
+        
+        tmp0 = _mm_add_ps(tmp0, _mm_add_ps(z1, z3));
+        tmp1 = _mm_add_ps(tmp1, _mm_add_ps(z2, z4));
+        tmp2 = _mm_add_ps(tmp2, _mm_add_ps(z2, z3));
+        tmp3 = _mm_add_ps(tmp3, _mm_add_ps(z1, z4));
+        
+        out[0] = _mm_add_ps(tmp10, tmp3);
+        out[7] = _mm_sub_ps(tmp10, tmp3);
+        out[1] = _mm_add_ps(tmp11, tmp2);
+        out[6] = _mm_sub_ps(tmp11, tmp2);
+        out[2] = _mm_add_ps(tmp12, tmp1);
+        out[5] = _mm_sub_ps(tmp12, tmp1);
+        out[3] = _mm_add_ps(tmp13, tmp0);
+        out[4] = _mm_sub_ps(tmp13, tmp0);
+    }
+    
+    /// 1D IDCT of 8 vectors whose last four are zero
+    ///
+    /// The LLM factorization with the zero terms removed, the odd part
+    /// reduces to its four rotations by multiples of π/16.
+    static inline void idct1DHalf(const __m128 in[8], __m128 out[8])
+    {
+        // Even part, from the coefficients 0 and 2
+        __m128 even0 = _mm_mul_ps(in[2], _mm_set1_ps(1.306562965f));
+        __m128 even1 = _mm_mul_ps(in[2], _mm_set1_ps(0.541196100f));
+        
+        __m128 tmp10 = _mm_add_ps(in[0], even0);
+        __m128 tmp13 = _mm_sub_ps(in[0], even0);
+        __m128 tmp11 = _mm_add_ps(in[0], even1);
+        __m128 tmp12 = _mm_sub_ps(in[0], even1);
+        
+        // Odd part, from the coefficients 1 and 3
+        __m128 tmp3 = _mm_add_ps(_mm_mul_ps(in[1], _mm_set1_ps(1.387039845f)), _mm_mul_ps(in[3], _mm_set1_ps(1.175875602f)));
+        __m128 tmp2 = _mm_sub_ps(_mm_mul_ps(in[1], _mm_set1_ps(1.175875602f)), _mm_mul_ps(in[3], _mm_set1_ps(0.275899379f)));
+        __m128 tmp1 = _mm_sub_ps(_mm_mul_ps(in[1], _mm_set1_ps(0.785694958f)), _mm_mul_ps(in[3], _mm_set1_ps(1.387039845f)));
+        __m128 tmp0 = _mm_sub_ps(_mm_mul_ps(in[1], _mm_set1_ps(0.275899379f)), _mm_mul_ps(in[3], _mm_set1_ps(0.785694958f)));
+        
+        out[0] = _mm_add_ps(tmp10, tmp3);
+        out[7] = _mm_sub_ps(tmp10, tmp3);
+        out[1] = _mm_add_ps(tmp11, tmp2);
+        out[6] = _mm_sub_ps(tmp11, tmp2);
+        out[2] = _mm_add_ps(tmp12, tmp1);
+        out[5] = _mm_sub_ps(tmp12, tmp1);
+        out[3] = _mm_add_ps(tmp13, tmp0);
+        out[4] = _mm_sub_ps(tmp13, tmp0);
+    }
+    
+    /// Transpose an 8x8 matrix stored as the left and right halves of its rows
+    static inline void transpose8x8(__m128 left[8], __m128 right[8])
+    {
+        _MM_TRANSPOSE4_PS(left[0], left[1], left[2], left[3]);
+        _MM_TRANSPOSE4_PS(left[4], left[5], left[6], left[7]);
+        _MM_TRANSPOSE4_PS(right[0], right[1], right[2], right[3]);
+        _MM_TRANSPOSE4_PS(right[4], right[5], right[6], right[7]);
+        
+        // Swap the top right and the bottom left 4x4 blocks
+        for (int i = 0; i < 4; ++i)
+        {
+            __m128 block = right[i];
+            right[i] = left[i + 4];
+            left[i + 4] = block;
+        }
+    }
+    
+    /// IDCT of a block whose non-zero coefficients are all in its
+    /// top left SIZE x SIZE corner, SIZE is 4 or 8
+    template <int SIZE>
+    static inline void idctBlock(const CoefficientBlock& block, const DequantizationTable& table, UInt8* output, const std::size_t stride)
+    {
+        const __m128i* in = reinterpret_cast<const __m128i*>(block.coeffs.data());
+        const float* factors = table.floatFactors.data();
+        __m128 left[8], right[8];
+        __m128 values[8];
+        
+        auto transform = [](const __m128 src[8], __m128 dst[8])
+        {
+            if (SIZE == 4)
+                idct1DHalf(src, dst);
+            else
+                idct1D(src, dst);
+        };
+        
+        // Pass 1: columns, the rows of the block are the inputs, sign
+        // extended to 32 bits, converted and de-quantized on load
+        __m128i rows[8];
+        
+        for (int v = 0; v < SIZE; ++v)
+            rows[v] = _mm_load_si128(in + v);
+        
+        for (int v = 0; v < SIZE; ++v)
+        {
+            __m128i coeffs = _mm_srai_epi32(_mm_unpacklo_epi16(rows[v], rows[v]), 16);
+            values[v] = _mm_mul_ps(_mm_cvtepi32_ps(coeffs), _mm_loadu_ps(factors + v * 8));
+        }
+        
+        transform(values, left);
+        
+        if (SIZE == 4)
+        {
+            for (int y = 0; y < 8; ++y)
+                right[y] = _mm_setzero_ps();
+        }
+        else
+        {
+            for (int v = 0; v < 8; ++v)
+            {
+                __m128i coeffs = _mm_srai_epi32(_mm_unpackhi_epi16(rows[v], rows[v]), 16);
+                values[v] = _mm_mul_ps(_mm_cvtepi32_ps(coeffs), _mm_loadu_ps(factors + v * 8 + 4));
+            }
+            
+            transform(values, right);
+        }
+        
+        // Pass 2: rows, transposed so the lanes are the rows of the block,
+        // the results are transposed back to rows of samples
+        transpose8x8(left, right);
+        
+        __m128 samplesLeft[8], samplesRight[8];
+        transform(left, samplesLeft);
+        transform(right, samplesRight);
+        
+        transpose8x8(samplesLeft, samplesRight);
+        
+        // Level shift, round and clamp, the factors removed the
+        // factor 8 the two passes add
+        const __m128 shift = _mm_set1_ps(128.0f);
+        
+        for (int y = 0; y < 8; ++y)
+        {
+            __m128i l = _mm_cvtps_epi32(_mm_add_ps(samplesLeft[y], shift));
+            __m128i r = _mm_cvtps_epi32(_mm_add_ps(samplesRight[y], shift));
+            __m128i samples = _mm_packs_epi32(l, r);
+            
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(output + y * stride), _mm_packus_epi16(samples, samples));
+        }
+    }
+    
+    void idctSSE2(const CoefficientBlock& block, const DequantizationTable& table, UInt8* output, const std::size_t stride)
+    {
+        idctBlock<8>(block, table, output, stride);
+    }
+    
+    void idctSSE2TopLeft(const CoefficientBlock& block, const DequantizationTable& table, UInt8* output, const std::size_t stride)
+    {
+        idctBlock<4>(block, table, output, stride);
+    }
+}
+
+#endif // __SSE2__
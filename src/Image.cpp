@@ -3,103 +3,527 @@
 #include <arpa/inet.h> // htons
 #include <string>
 #include <cmath>
+#include <algorithm>
 
 #include "Utility.hpp"
 #include "Image.hpp"
+#include "ImageWriter.hpp"
+#include "ColorConversion.hpp"
 
 namespace kpeg
 {
+    const char* getPixelFormatName(const PixelFormat format)
+    {
+        switch (format)
+        {
+            case PIXEL_FORMAT_RGB8  : return "rgb8";
+            case PIXEL_FORMAT_BGR8  : return "bgr8";
+            case PIXEL_FORMAT_RGBA8 : return "rgba8";
+            case PIXEL_FORMAT_BGRA8 : return "bgra8";
+            case PIXEL_FORMAT_GRAY8 : return "gray8";
+            case PIXEL_FORMAT_I420  : return "i420";
+            case PIXEL_FORMAT_I444  : return "i444";
+        }
+        
+        return "unknown";
+    }
+    
+    int getPlaneCount(const PixelFormat format)
+    {
+        return format == PIXEL_FORMAT_I420 || format == PIXEL_FORMAT_I444 ? 3 : 1;
+    }
+    
+    int getBytesPerPixel(const PixelFormat format)
+    {
+        switch (format)
+        {
+            case PIXEL_FORMAT_RGB8  :
+            case PIXEL_FORMAT_BGR8  : return 3;
+            case PIXEL_FORMAT_RGBA8 :
+            case PIXEL_FORMAT_BGRA8 : return 4;
+            default                 : return 1;
+        }
+    }
+    
+    const char* getRawFileExtension(const PixelFormat format)
+    {
+        if (format == PIXEL_FORMAT_GRAY8)
+            return ".pgm";
+        
+        if (format == PIXEL_FORMAT_RGBA8 || format == PIXEL_FORMAT_BGRA8)
+            return ".pam";
+        
+        return getPlaneCount(format) == 3 ? ".yuv" : ".ppm";
+    }
+    
+    /// Get the strides of the planes of an image in a caller's buffer
+    ///
+    /// @param format the pixel format
+    /// @param width the width of the image
+    /// @param stride the stride of the first plane, 0 for rows without padding
+    /// @param strides the strides of the planes
+    static void getBufferStrides(const PixelFormat format,
+                                 const std::size_t width,
+                                 const std::size_t stride,
+                                 std::size_t strides[3])
+    {
+        strides[0] = stride == 0 ? width * getBytesPerPixel(format) : stride;
+        strides[1] = strides[2] = format == PIXEL_FORMAT_I420 ? (strides[0] + 1) / 2 : strides[0];
+    }
+    
+    std::size_t getImageBufferSize(const PixelFormat format,
+                                   const std::size_t width,
+                                   const std::size_t height,
+                                   const std::size_t stride)
+    {
+        std::size_t strides[3];
+        getBufferStrides(format, width, stride, strides);
+        
+        if (strides[0] < width * getBytesPerPixel(format))
+            return 0;
+        
+        if (getPlaneCount(format) == 1)
+            return strides[0] * height;
+        
+        std::size_t chromaHeight = format == PIXEL_FORMAT_I420 ? (height + 1) / 2 : height;
+        return strides[0] * height + 2 * strides[1] * chromaHeight;
+    }
+    
     Image::Image() :
         width{0},
         height{0},
-        m_pixelPtr{nullptr}
+        m_format{PIXEL_FORMAT_RGB8},
+        m_paddedWidth{0},
+        m_paddedHeight{0},
+        m_buffer{nullptr},
+        m_planeOffsets{},
+        m_strides{},
+        m_blockSize{8},
+        m_hFactor{1},
+        m_vFactor{1},
+        m_upsampling{UPSAMPLING_FANCY},
+        m_convert{nullptr},
+        m_MCUsPerRow{0},
+        m_MCURows{0},
+        m_MCURowsAdded{0},
+        m_componentStrides{},
+        m_componentHeights{}
     {
         logFile << "Created new Image object" << std::endl;
     }
     
-    void Image::createImageFromMCUs(const std::vector<MCU>& MCUs)
+    void Image::clear()
+    {
+        width = 0;
+        height = 0;
+        m_MCURows = 0;
+        m_MCURowsAdded = 0;
+    }
+    
+    /// Copy one row of a component's samples out of a row of MCUs
+    ///
+    /// @param MCUs the row of MCUs
+    /// @param component the component
+    /// @param MCUsPerRow the number of MCUs in the row
+    /// @param blockSize the number of samples per block row and column
+    /// @param row the row of samples in the row of MCUs
+    /// @param output the row to write the samples to
+    static void gatherComponentRow(const MCU* MCUs,
+                                   const Component& component,
+                                   const std::size_t MCUsPerRow,
+                                   const int blockSize,
+                                   const int row,
+                                   UInt8* output)
+    {
+        int firstBlock = component.firstBlock + row / blockSize * component.horizontalSampling;
+        int v = row % blockSize;
+        
+        for (std::size_t m = 0; m < MCUsPerRow; ++m)
+        {
+            for (int h = 0; h < component.horizontalSampling; ++h, output += blockSize)
+                std::copy_n(&MCUs[m].getSamples(firstBlock + h)[v * 8], blockSize, output);
+        }
+    }
+    
+    /// Halve a row of chrominance samples for I420 images
+    ///
+    /// Averages the two rows and, unless the rows are already
+    /// horizontally subsampled, each pair of samples across.
+    ///
+    /// @param first the first row of chrominance samples
+    /// @param second the second row, the same as the first if the rows are already vertically subsampled
+    /// @param output the row of halved samples
+    /// @param count the number of halved samples
+    /// @param hFactor the horizontal subsampling of the rows: 1 or 2
+    /// @param rowWidth the number of samples in the rows, the last sample is repeated past them
+    static void halveChromaRow(const UInt8* first,
+                               const UInt8* second,
+                               UInt8* output,
+                               const std::size_t count,
+                               const int hFactor,
+                               const std::size_t rowWidth)
+    {
+        if (hFactor == 2)
+        {
+            if (first == second)
+                std::copy_n(first, count, output);
+            else
+                for (std::size_t u = 0; u < count; ++u)
+                    output[u] = UInt8((first[u] + second[u] + 1) >> 1);
+            return;
+        }
+        
+        for (std::size_t u = 0; u < count; ++u)
+        {
+            std::size_t left = 2 * u, right = std::min(2 * u + 1, rowWidth - 1);
+            
+            output[u] = UInt8((first[left] + first[right] + second[left] + second[right] + 2) >> 2);
+        }
+    }
+    
+    void Image::createImageFromMCUs(const std::vector<MCU>& MCUs,
+                                    const std::vector<Component>& components,
+                                    const int blockSize,
+                                    const PixelFormat format,
+                                    const UpsamplingMode upsampling)
+    {
+        startImage(components, blockSize, format, upsampling);
+        
+        for (std::size_t MCURow = 0; MCURow < m_MCURows; ++MCURow)
+            addMCURow(&MCUs[MCURow * m_MCUsPerRow]);
+    }
+    
+    void Image::startImage(const std::vector<Component>& components,
+                           const int blockSize,
+                           const PixelFormat format,
+                           const UpsamplingMode upsampling,
+                           UInt8* buffer,
+                           const std::size_t stride)
+    {
+        logFile << "Creating " << getPixelFormatName(format) << " Image from rows of MCUs..." << std::endl;
+        
+        // The luminance has the largest sampling factors, it sets the size of the MCUs
+        const int compCount = components.size();
+        const int maxH = components[0].horizontalSampling;
+        const int maxV = components[0].verticalSampling;
+        
+        m_components = components;
+        m_blockSize = blockSize;
+        m_hFactor = maxH / components[compCount - 1].horizontalSampling;
+        m_vFactor = maxV / components[compCount - 1].verticalSampling;
+        
+        const std::size_t MCUWidth = blockSize * maxH;
+        const std::size_t MCUHeight = blockSize * maxV;
+        
+        m_MCUsPerRow = (width + MCUWidth - 1) / MCUWidth;
+        m_MCURows = (height + MCUHeight - 1) / MCUHeight;
+        m_MCURowsAdded = 0;
+        
+        // Nothing to upsample without subsampling
+        m_upsampling = m_hFactor == 1 && m_vFactor == 1 ? UPSAMPLING_SIMPLE : upsampling;
+        
+        logFile << "MCU size: " << MCUWidth << "x" << MCUHeight << ", chroma subsampling: "
+                << m_hFactor << "x" << m_vFactor << std::endl;
+        
+        m_format = format;
+        
+        std::size_t strides[3];
+        
+        m_buffer = buffer;
+        
+        if (buffer != nullptr)
+        {
+            // The caller's buffer only holds the pixels of the image
+            m_paddedWidth = width;
+            m_paddedHeight = height;
+            m_pixels.clear();
+            
+            getBufferStrides(format, width, stride, strides);
+        }
+        else
+        {
+            // Every MCU is output whole, the planes are padded to the grid of MCUs
+            m_paddedWidth = m_MCUsPerRow * MCUWidth;
+            m_paddedHeight = m_MCURows * MCUHeight;
+            
+            for (int plane = 0; plane < 3; ++plane)
+                strides[plane] = utils::alignSize(getPaddedPlaneWidth(plane) * getBytesPerPixel(format), ROW_ALIGNMENT);
+            
+            m_pixels.assign(strides[0] * getPaddedPlaneHeight(0) +
+                            (getPlaneCount(format) == 3 ? 2 * strides[1] * getPaddedPlaneHeight(1) : 0), 0);
+        }
+        
+        // The planes follow each other
+        std::size_t offset = 0;
+        
+        for (int plane = 0; plane < 3; ++plane)
+        {
+            bool hasPlane = plane < getPlaneCount(format);
+            
+            m_planeOffsets[plane] = offset;
+            m_strides[plane] = hasPlane ? strides[plane] : 0;
+            offset += m_strides[plane] * getPaddedPlaneHeight(plane);
+        }
+        
+        // Grayscale images have neutral chrominance, which the color
+        // conversion turns into R = G = B
+        m_neutralChroma.clear();
+        
+        if (compCount == 1)
+        {
+            m_neutralChroma.assign(m_paddedWidth + 2, 128);
+            
+            for (int plane = 1; plane < getPlaneCount(format); ++plane)
+            {
+                for (std::size_t row = 0; row < getPaddedPlaneHeight(plane); ++row)
+                    std::fill_n(getPlaneData(plane) + row * getStride(plane), getPaddedPlaneWidth(plane), 128);
+            }
+        }
+        
+        // The rows of samples of each component, with a sample of padding
+        // on either side, for two rows of MCUs and the row just above them
+        for (int c = 0; c < compCount; ++c)
+        {
+            m_componentStrides[c] = m_MCUsPerRow * blockSize * components[c].horizontalSampling + 2;
+            m_componentHeights[c] = blockSize * components[c].verticalSampling;
+            m_componentRows[c].assign(m_componentStrides[c] * (2 * m_componentHeights[c] + 1), 0);
+        }
+        
+        // The chrominance of the last even row, for halving the chrominance of I420 images
+        for (int c = 0; c < 2; ++c)
+            m_evenChromaRows[c].resize(format == PIXEL_FORMAT_I420 && compCount == 3 ? m_componentStrides[c + 1] : 0);
+        
+        m_convert = getYCbCrToRGBFunction(format, m_hFactor, m_upsampling);
+    }
+    
+    void Image::addMCURow(const MCU* MCUs)
     {
-        logFile << "Creating Image from MCU vector..." << std::endl;
+        const std::size_t MCURow = m_MCURowsAdded++;
+        const bool isLastRow = MCURow + 1 == m_MCURows;
+        
+        // Gather the samples of the row of MCUs
+        for (std::size_t c = 0; c < m_components.size(); ++c)
+        {
+            const int rows = m_componentHeights[c];
+            const std::size_t rowWidth = m_componentStrides[c] - 2;
+            
+            for (int row = 0; row < rows; ++row)
+            {
+                UInt8* samples = getComponentRow(c, MCURow, row);
+                
+                gatherComponentRow(MCUs, m_components[c], m_MCUsPerRow, m_blockSize, row, samples);
+                
+                // Repeat the edge samples into the padding
+                samples[-1] = samples[0];
+                samples[rowWidth] = samples[rowWidth - 1];
+            }
+            
+            // The context row of the chrominance on the top edge of the
+            // image repeats the edge row
+            if (c > 0 && MCURow == 0)
+                std::copy_n(getComponentRow(c, 0, 0) - 1, m_componentStrides[c], getComponentRow(c, 0, -1) - 1);
+        }
+        
+        // The first row of this row of MCUs completes the context of the
+        // previous one, which can now be output
+        if (MCURow > 0)
+            outputMCURow(MCURow - 1);
+        
+        if (!isLastRow)
+            return;
         
-        int mcuNum = 0;
+        // The context row of the chrominance on the bottom edge repeats the
+        // edge row, it takes the place of the previous row of MCUs' top
+        // context row in the ring, so it's only set once that is output
+        for (std::size_t c = 1; c < m_components.size(); ++c)
+        {
+            const int rows = m_componentHeights[c];
+            
+            std::copy_n(getComponentRow(c, MCURow, rows - 1) - 1, m_componentStrides[c], getComponentRow(c, MCURow, rows) - 1);
+        }
         
-        int jpegWidth = width % 8 == 0 ? width : width + 8 - (width % 8);
-        int jpegHeight = height % 8 == 0 ? height : height + 8 - (height % 8);
+        outputMCURow(MCURow);
         
-        // Create a pixel pointer of size (Image width) x (Image height)
-        m_pixelPtr = std::make_shared<std::vector<std::vector<Pixel>>>(
-            jpegHeight, std::vector<Pixel>(jpegWidth, Pixel()));
+        logFile << "Finished created Image from MCU [OK]" << std::endl;
+    }
+    
+    void Image::outputMCURow(const std::size_t MCURow)
+    {
+        const std::size_t MCUHeight = m_blockSize * m_components[0].verticalSampling;
+        const bool isGray = m_components.size() == 1;
         
-        // Populate the pixel pointer based on data from the specified MCUs
-        for (int y = 0; y <= jpegHeight - 8; y += 8)
+        // Output the row of MCUs a row of pixels at a time, the pixels of
+        // the edge MCUs that lie outside the image go to the padding, if any
+        for (std::size_t v = 0; v < MCUHeight && MCURow * MCUHeight + v < m_paddedHeight; ++v)
         {
-            for (int x = 0; x <= jpegWidth - 8; x += 8)
+            std::size_t row = MCURow * MCUHeight + v;
+            const UInt8* Y = getComponentRow(0, MCURow, v);
+            const UInt8* near[2];
+            const UInt8* far[2];
+            
+            // Each pixel row takes its nearest chrominance row, fancy
+            // upsampling blends in the row on the other side of it
+            for (int c = 0; c < 2; ++c)
+            {
+                int chromaRow = v / m_vFactor;
+                
+                if (isGray)
+                {
+                    near[c] = far[c] = m_neutralChroma.data() + 1;
+                    continue;
+                }
+                
+                near[c] = getComponentRow(c + 1, MCURow, chromaRow);
+                far[c] = m_vFactor == 1 ? near[c] : getComponentRow(c + 1, MCURow, v % 2 == 0 ? chromaRow - 1 : chromaRow + 1);
+            }
+            
+            // The chrominance planes of grayscale images are already filled in
+            if (isGray && getPlaneCount(m_format) == 3)
+            {
+                std::copy_n(Y, m_paddedWidth, getPlaneData(0) + row * getStride(0));
+                continue;
+            }
+            
+            switch (m_format)
             {
-                auto pixelBlock = MCUs[mcuNum].getAllMatrices();
+                case PIXEL_FORMAT_GRAY8 :
+                    std::copy_n(Y, m_paddedWidth, getPlaneData(0) + row * getStride(0));
+                    break;
+                
+                case PIXEL_FORMAT_I444 :
+                    std::copy_n(Y, m_paddedWidth, getPlaneData(0) + row * getStride(0));
+                    
+                    for (int c = 0; c < 2; ++c)
+                        upsampleChromaRow(near[c], far[c], getPlaneData(c + 1) + row * getStride(c + 1), m_paddedWidth, m_hFactor, m_upsampling);
+                    break;
                 
-                for (int v = 0; v < 8; ++v)
+                case PIXEL_FORMAT_I420 :
                 {
-                    for (int u = 0; u < 8; ++u)
+                    std::copy_n(Y, m_paddedWidth, getPlaneData(0) + row * getStride(0));
+                    
+                    if (row % 2 == 0 && m_vFactor == 1)
                     {
-                        (*m_pixelPtr)[y + v][x + u].comp[0] = pixelBlock[0][v][u]; // R
-                        (*m_pixelPtr)[y + v][x + u].comp[1] = pixelBlock[1][v][u]; // G
-                        (*m_pixelPtr)[y + v][x + u].comp[2] = pixelBlock[2][v][u]; // B
+                        std::copy_n(near[0], m_componentStrides[1] - 2, m_evenChromaRows[0].data());
+                        std::copy_n(near[1], m_componentStrides[2] - 2, m_evenChromaRows[1].data());
                     }
+                    
+                    // Vertically subsampled chrominance already has a row
+                    // per even row, otherwise wait for the odd row, or
+                    // the last row of the image if it is even
+                    if ((m_vFactor == 2 && row % 2 == 0) || (m_vFactor == 1 && ((row % 2 == 1 && row < height) || row + 1 == height)))
+                    {
+                        for (int c = 0; c < 2; ++c)
+                        {
+                            halveChromaRow(m_vFactor == 2 ? near[c] : m_evenChromaRows[c].data(), near[c],
+                                           getPlaneData(c + 1) + row / 2 * getStride(c + 1),
+                                           getPaddedPlaneWidth(c + 1), m_hFactor, width);
+                        }
+                    }
+                    break;
                 }
-            
-                mcuNum++;
+                
+                default :
+                    m_convert(Y, near[0], near[1], far[0], far[1], getPlaneData(0) + row * getStride(0), m_paddedWidth);
+                    break;
             }
         }
+    }
+    
+    UInt8* Image::getComponentRow(const int component, const std::size_t MCURow, const int row)
+    {
+        // The rows of successive rows of MCUs follow each other around a
+        // ring of buffered rows, wrapping over the oldest ones
+        const std::ptrdiff_t ringRows = 2 * m_componentHeights[component] + 1;
+        std::ptrdiff_t index = (std::ptrdiff_t(MCURow) * m_componentHeights[component] + row) % ringRows;
         
-        // Trim the image width to nearest multiple of 8
-        if (width != jpegWidth)
-        {
-            for (auto&& row : *m_pixelPtr)
-                for (int c = 0; c < 8 - width % 8; ++c)
-                    row.pop_back();
-        }
+        if (index < 0)
+            index += ringRows;
         
-        // Trim the image height to nearest multiple of 8
-        if (height != jpegHeight)
-        {
-            for (int c = 0; c < 8 - height % 8; ++c)
-                m_pixelPtr->pop_back();
-        }        
-
-        logFile << "Finished created Image from MCU [OK]" << std::endl;
+        return &m_componentRows[component][index * m_componentStrides[component] + 1];
     }
     
     const bool Image::dumpRawData(const std::string& filename)
     {
-        if (m_pixelPtr == nullptr)
+        if (getPlane(0) == nullptr)
         {
-            logFile << "Unable to create dump file \'" + filename + "\', Invalid pixel pointer" << std::endl;
+            logFile << "Unable to create dump file \'" + filename + "\', the image is empty" << std::endl;
             return false;
         }
         
-        std::ofstream dumpFile(filename, std::ios::out);
+        ImageWriter writer;
         
-        if (!dumpFile.is_open() || !dumpFile.good())
+        if (!writer.open(filename, m_format, width, height))
         {
             logFile << "Unable to create dump file \'" + filename + "\'." << std::endl;
             return false;
         }
         
-        dumpFile << "P6" << std::endl;
-        dumpFile << "# PPM dump created using libKPEG: https://github.com/TheIllusionistMirage/libKPEG" << std::endl;
-        dumpFile << width << " " << height << std::endl;
-        dumpFile << 255 << std::endl;
+        // Planar images are written plane by plane
+        for (int plane = 0; plane < getPlaneCount(m_format); ++plane)
+            writer.writeRows(getPlane(plane), getStride(plane), getPlaneHeight(plane), plane);
         
-        for (auto&& row : *m_pixelPtr)
+        if (!writer.close())
         {
-            for (auto&& pixel : row)
-                dumpFile << (UInt8)pixel.comp[RGBComponents::RED]
-                         << (UInt8)pixel.comp[RGBComponents::GREEN]
-                         << (UInt8)pixel.comp[RGBComponents::BLUE];
+            logFile << "Unable to write dump file \'" + filename + "\'." << std::endl;
+            return false;
         }
         
         logFile << "Raw image data dumped to file: \'" + filename + "\'." << std::endl;
-        dumpFile.close();
         return true;
     }
+    
+    PixelFormat Image::getPixelFormat() const
+    {
+        return m_format;
+    }
+    
+    const UInt8* Image::getPlane(const int plane) const
+    {
+        if (m_strides[plane] == 0)
+            return nullptr;
+        
+        return (m_buffer != nullptr ? m_buffer : m_pixels.data()) + m_planeOffsets[plane];
+    }
+    
+    UInt8* Image::getPlaneData(const int plane)
+    {
+        return const_cast<UInt8*>(static_cast<const Image*>(this)->getPlane(plane));
+    }
+    
+    std::size_t Image::getStride(const int plane) const
+    {
+        return m_strides[plane];
+    }
+    
+    std::size_t Image::getPlaneWidth(const int plane) const
+    {
+        return m_format == PIXEL_FORMAT_I420 && plane > 0 ? (width + 1) / 2 : width;
+    }
+    
+    std::size_t Image::getPlaneHeight(const int plane) const
+    {
+        return m_format == PIXEL_FORMAT_I420 && plane > 0 ? (height + 1) / 2 : height;
+    }
+    
+    std::size_t Image::getCompletedRowCount() const
+    {
+        if (m_MCURowsAdded == 0)
+            return 0;
+        
+        // A row of MCUs is output once the next one is added, the last one right away
+        std::size_t MCURowsOutput = m_MCURowsAdded == m_MCURows ? m_MCURows : m_MCURowsAdded - 1;
+        std::size_t MCUHeight = m_blockSize * m_components[0].verticalSampling;
+        
+        return std::min(height, MCURowsOutput * MCUHeight);
+    }
+    
+    std::size_t Image::getPaddedPlaneWidth(const int plane) const
+    {
+        return m_format == PIXEL_FORMAT_I420 && plane > 0 ? (m_paddedWidth + 1) / 2 : m_paddedWidth;
+    }
+    
+    std::size_t Image::getPaddedPlaneHeight(const int plane) const
+    {
+        return m_format == PIXEL_FORMAT_I420 && plane > 0 ? (m_paddedHeight + 1) / 2 : m_paddedHeight;
+    }
 }
@@ -0,0 +1,216 @@
+/// Image writer module implementation
+
+#include <cerrno>
+#include <climits>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "ImageWriter.hpp"
+#include "Image.hpp"
+#include "Utility.hpp"
+
+namespace kpeg
+{
+    /// The most I/O vector entries passed to a single writev
+#if defined(IOV_MAX)
+    static const std::size_t MAX_ENTRIES = IOV_MAX;
+#else
+    static const std::size_t MAX_ENTRIES = 1024;
+#endif
+    
+    /// The size of the batches of BGR rows copied in RGB order, in bytes
+    static const std::size_t SWAP_BATCH_SIZE = 256 * 1024;
+    
+    /// Write a whole I/O vector, picking up after partial writes
+    ///
+    /// @param file the file descriptor to write to
+    /// @param entries the entries to write, updated as they're written
+    /// @param count the number of entries
+    /// @return true if everything was written, else false
+    static bool writeAll(const int file, struct iovec* entries, int count)
+    {
+        while (count > 0)
+        {
+            ssize_t written = writev(file, entries, count);
+            
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                
+                return false;
+            }
+            
+            // Skip the entries written, and what was written of the next one
+            while (count > 0 && std::size_t(written) >= entries->iov_len)
+            {
+                written -= entries->iov_len;
+                ++entries;
+                --count;
+            }
+            
+            if (count > 0)
+            {
+                entries->iov_base = static_cast<char*>(entries->iov_base) + written;
+                entries->iov_len -= written;
+            }
+        }
+        
+        return true;
+    }
+    
+    ImageWriter::ImageWriter() :
+        m_file{-1},
+        m_format{PIXEL_FORMAT_RGB8},
+        m_width{0},
+        m_failed{false}
+    {
+    }
+    
+    ImageWriter::~ImageWriter()
+    {
+        close();
+    }
+    
+    bool ImageWriter::open(const std::string& filename,
+                           const PixelFormat format,
+                           const std::size_t width,
+                           const std::size_t height)
+    {
+        close();
+        
+        m_file = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        
+        if (m_file < 0)
+            return false;
+        
+        m_format = format;
+        m_width = width;
+        m_failed = false;
+        
+        // Planar images have no header
+        if (getPlaneCount(format) == 3)
+            return true;
+        
+        const std::string comment = "# PPM dump created using libKPEG: https://github.com/TheIllusionistMirage/libKPEG\n";
+        
+        if (format == PIXEL_FORMAT_RGBA8 || format == PIXEL_FORMAT_BGRA8)
+        {
+            m_header = "P7\n" + comment +
+                       "WIDTH " + std::to_string(width) + "\nHEIGHT " + std::to_string(height) +
+                       "\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n";
+        }
+        else
+        {
+            m_header = (format == PIXEL_FORMAT_GRAY8 ? "P5\n" : "P6\n") + comment +
+                       std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+        }
+        
+        append(m_header.data(), m_header.size());
+        
+        return true;
+    }
+    
+    bool ImageWriter::writeRows(const UInt8* rows,
+                                const std::size_t stride,
+                                const std::size_t count,
+                                const int plane)
+    {
+        if (m_file < 0 || m_failed)
+            return false;
+        
+        std::size_t width = m_format == PIXEL_FORMAT_I420 && plane > 0 ? (m_width + 1) / 2 : m_width;
+        std::size_t pixelSize = getBytesPerPixel(m_format);
+        std::size_t rowSize = width * pixelSize;
+        
+        if (m_format != PIXEL_FORMAT_BGR8 && m_format != PIXEL_FORMAT_BGRA8)
+        {
+            // Contiguous rows go out as one entry
+            if (stride == rowSize)
+                append(rows, rowSize * count);
+            else
+            {
+                for (std::size_t row = 0; row < count; ++row)
+                    append(rows + row * stride, rowSize);
+            }
+            
+            return flush();
+        }
+        
+        // The channels of BGR rows are swapped a batch of rows at a time
+        std::size_t batchRows = std::max<std::size_t>(1, SWAP_BATCH_SIZE / std::max<std::size_t>(1, rowSize));
+        
+        for (std::size_t first = 0; first < count; first += batchRows)
+        {
+            std::size_t batch = std::min(batchRows, count - first);
+            m_swapped.resize(batch * rowSize);
+            
+            for (std::size_t row = 0; row < batch; ++row)
+            {
+                const UInt8* pixels = rows + (first + row) * stride;
+                UInt8* output = m_swapped.data() + row * rowSize;
+                
+                for (std::size_t u = 0; u < rowSize; u += pixelSize)
+                {
+                    output[u + 0] = pixels[u + 2];
+                    output[u + 1] = pixels[u + 1];
+                    output[u + 2] = pixels[u + 0];
+                    
+                    if (pixelSize == 4)
+                        output[u + 3] = pixels[u + 3];
+                }
+            }
+            
+            append(m_swapped.data(), m_swapped.size());
+            
+            if (!flush())
+                return false;
+        }
+        
+        return true;
+    }
+    
+    bool ImageWriter::close()
+    {
+        if (m_file < 0)
+            return false;
+        
+        // An image without rows is still written, as its header
+        flush();
+        
+        bool written = !m_failed;
+        
+        if (::close(m_file) != 0)
+            written = false;
+        
+        m_file = -1;
+        m_entries.clear();
+        
+        return written;
+    }
+    
+    void ImageWriter::append(const void* data, const std::size_t size)
+    {
+        if (m_entries.size() == MAX_ENTRIES)
+            flush();
+        
+        if (size > 0)
+            m_entries.push_back({ const_cast<void*>(data), size });
+    }
+    
+    bool ImageWriter::flush()
+    {
+        if (m_failed)
+            return false;
+        
+        m_failed = !writeAll(m_file, m_entries.data(), int(m_entries.size()));
+        m_entries.clear();
+        
+        if (m_failed)
+            logFile << "Unable to write the image data" << std::endl;
+        
+        return !m_failed;
+    }
+}
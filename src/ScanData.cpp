@@ -0,0 +1,91 @@
+/// Scan data module implementation
+
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "ScanData.hpp"
+#include "Markers.hpp"
+
+namespace kpeg
+{
+    const UInt8* findMarkerByte(const UInt8* begin, const UInt8* end)
+    {
+#if defined(__SSE2__)
+        const __m128i markerBytes = _mm_set1_epi8(char(JFIF_BYTE_FF));
+        
+        for (; end - begin >= 16; begin += 16)
+        {
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+            int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, markerBytes));
+            
+            if (mask != 0)
+                return begin + __builtin_ctz(mask);
+        }
+#endif
+        for (; begin != end; ++begin)
+        {
+            if (*begin == JFIF_BYTE_FF)
+                return begin;
+        }
+        
+        return end;
+    }
+    
+    ScanDataInfo unstuffScanData(const UInt8* data,
+                                 const std::size_t size,
+                                 UInt8* output,
+                                 std::vector<std::size_t>& restartOffsets)
+    {
+        restartOffsets.clear();
+        
+        const UInt8* end = data + size;
+        const UInt8* read = data;
+        UInt8* write = output;
+        
+        while (true)
+        {
+            const UInt8* marker = findMarkerByte(read, end);
+            
+            // Copy the run of data bytes, in place there's nothing to
+            // do until the first byte is removed
+            if (write != read && marker != read)
+                std::memmove(write, read, marker - read);
+            
+            write += marker - read;
+            
+            if (marker + 1 >= end)
+                return { std::size_t(write - output), std::size_t(marker - data) };
+            
+            UInt8 byte = marker[1];
+            
+            // Stuffed byte, 0xFF is data
+            if (byte == JFIF_BYTE_0)
+            {
+                *write++ = JFIF_BYTE_FF;
+                read = marker + 2;
+            }
+            
+            // Restart marker, the next restart interval starts here
+            else if (byte >= JFIF_RST0 && byte <= JFIF_RST7)
+            {
+                restartOffsets.push_back(write - output);
+                read = marker + 2;
+            }
+            
+            // Fill byte, markers may be preceded by any number of 0xFF
+            else if (byte == JFIF_BYTE_FF)
+            {
+                read = marker + 1;
+            }
+            
+            // Any other marker ends the scan data
+            else
+            {
+                return { std::size_t(write - output), std::size_t(marker - data) };
+            }
+        }
+    }
+}
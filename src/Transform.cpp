@@ -45,25 +45,6 @@ namespace kpeg
         return matOrder[row][column];
     }
 
-    const Int16 bitStringtoValue(const std::string& bitStr)
-    {
-        if (bitStr == "")
-            return 0x0000;
-        
-        Int16 value = 0x0000;
-        
-        char sign = bitStr[0];
-        int factor = sign == '0' ? -1 : 1;
-            
-        for (auto i = 0; i < bitStr.size(); ++i)
-        {
-            if (bitStr[i] == sign)
-                value += Int16(std::pow(2, bitStr.size() - 1 - i));
-        }
-        
-        return factor * value;
-    }
-    
     const Int16 getValueCategory(const Int16 value)
     {
         if (value == 0x0000)
@@ -1,3 +1,92 @@
+#include <cstring>
+#include <mutex>
+
 #include "Utility.hpp"
 
-std::ofstream logFile("kpeg.log", std::ios::out);
\ No newline at end of file
+thread_local kpeg::utils::LogStream logFile;
+
+namespace kpeg
+{
+    namespace utils
+    {
+        /// Get the file the logs of all threads are written to
+        static std::ofstream& getLogFile()
+        {
+            static std::ofstream file("kpeg.log", std::ios::out);
+            return file;
+        }
+        
+        /// Get the lock serializing the writes to the log file
+        static std::mutex& getLogMutex()
+        {
+            static std::mutex mutex;
+            return mutex;
+        }
+        
+        LogBuffer::LogBuffer()
+        {
+            setp(m_buffer, m_buffer + BUFFER_SIZE);
+        }
+        
+        LogBuffer::~LogBuffer()
+        {
+            writeLines(true, true);
+        }
+        
+        LogBuffer::int_type LogBuffer::overflow(int_type ch)
+        {
+            writeLines(false, false);
+            
+            // A line longer than the buffer goes out in pieces
+            if (pptr() == epptr())
+                writeLines(true, false);
+            
+            if (!traits_type::eq_int_type(ch, traits_type::eof()))
+            {
+                *pptr() = traits_type::to_char_type(ch);
+                pbump(1);
+            }
+            
+            return traits_type::not_eof(ch);
+        }
+        
+        int LogBuffer::sync()
+        {
+            writeLines(false, true);
+            return 0;
+        }
+        
+        void LogBuffer::writeLines(const bool all, const bool flush)
+        {
+            std::size_t size = pptr() - pbase();
+            std::size_t end = size;
+            
+            if (!all)
+            {
+                while (end > 0 && pbase()[end - 1] != '\n')
+                    --end;
+            }
+            
+            if (end > 0)
+            {
+                std::lock_guard<std::mutex> lock(getLogMutex());
+                
+                getLogFile().write(pbase(), end);
+                
+                if (flush)
+                    getLogFile().flush();
+            }
+            
+            // Keep the unfinished line at the start of the buffer
+            std::memmove(m_buffer, pbase() + end, size - end);
+            setp(m_buffer, m_buffer + BUFFER_SIZE);
+            pbump(int(size - end));
+        }
+        
+        LogStream::LogStream() :
+            std::ostream(nullptr)
+        {
+            rdbuf(&m_buffer);
+        }
+    }
+}
@@ -0,0 +1,133 @@
+/// IDCT accuracy test
+///
+/// Decodes random blocks of coefficients with the fixed-point IDCT
+/// kernels and checks every sample against the floating point reference
+/// IDCT, which they must match within 1.
+
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "IDCT.hpp"
+#include "Transform.hpp"
+
+using namespace kpeg;
+
+/// Set the zig-zag index of the last non-zero coefficient of a block
+static void updateLastNonZero(CoefficientBlock& block)
+{
+    block.lastNonZero = 0;
+    
+    for (int k = 0; k < 64; ++k)
+    {
+        if (block.coeffs[ZIGZAG_TO_NATURAL[k]] != 0)
+            block.lastNonZero = k;
+    }
+}
+
+/// Compare a kernel to the reference IDCT on a block
+///
+/// @return the largest difference of a sample
+static int compareToReference(IDCTFunction idct, const CoefficientBlock& block, const DequantizationTable& table)
+{
+    UInt8 reference[64];
+    UInt8 samples[64];
+    
+    idctFloatReference(block, table, reference, 8);
+    idct(block, table, samples, 8);
+    
+    int maxError = 0;
+    
+    for (int i = 0; i < 64; ++i)
+        maxError = std::max(maxError, std::abs(samples[i] - reference[i]));
+    
+    return maxError;
+}
+
+int main()
+{
+    std::mt19937 rng(1);
+    int failures = 0;
+    
+    // The coefficients are either de-quantized already (all factors 1),
+    // or small values scaled up by a typical luminance table
+    std::vector<UInt16> unitTable(64, 1);
+    std::vector<UInt16> luminanceTable(64);
+    
+    for (int k = 0; k < 64; ++k)
+        luminanceTable[k] = UInt16(16 + 2 * k);
+    
+    DequantizationTable tables[2];
+    prepareDequantizationTable(unitTable, tables[0]);
+    prepareDequantizationTable(luminanceTable, tables[1]);
+    
+    struct Kernel
+    {
+        const char* name;
+        IDCTFunction idct;
+        bool topLeftOnly;
+    };
+    
+    const Kernel kernels[] =
+    {
+        { "integer", idctInteger, false },
+        { "integer (top left)", idctIntegerTopLeft, true },
+        { "integer (dispatched)", getIDCTFunction(IDCT_INTEGER), false },
+    };
+    
+    const int ranges[] = { 5, 256, 512 };
+    
+    for (const Kernel& kernel : kernels)
+    {
+        int maxError = 0;
+        
+        for (int t = 0; t < 30000; ++t)
+        {
+            int range = ranges[t % 3];
+            int tableIndex = (t / 3) % 2;
+            
+            if (tableIndex == 1)
+                range = range / 16 + 1;
+            
+            std::uniform_int_distribution<int> value(-range, range);
+            CoefficientBlock block{};
+            
+            for (int i = 0; i < 64; ++i)
+            {
+                int row = i / 8;
+                int column = i % 8;
+                
+                // Sparse blocks, as most blocks are, every fourth block
+                if ((kernel.topLeftOnly && (row >= 4 || column >= 4)) || (t % 4 == 0 && row + column > 2))
+                    continue;
+                
+                // De-quantized coefficients of 8-bit samples are within 1023
+                int limit = 1023 / tables[tableIndex].integerFactors[i];
+                block.coeffs[i] = Int16(std::max(-limit, std::min(limit, value(rng))));
+            }
+            
+            // Large DC offsets with small AC coefficients
+            if (range == 5)
+                block.coeffs[0] = Int16(value(rng) * 100);
+            
+            updateLastNonZero(block);
+            
+            if (kernel.topLeftOnly && block.lastNonZero > IDCT_TOP_LEFT_LAST_ZIGZAG)
+                continue;
+            
+            maxError = std::max(maxError, compareToReference(kernel.idct, block, tables[tableIndex]));
+        }
+        
+        std::printf("%s IDCT: largest error %d\n", kernel.name, maxError);
+        
+        if (maxError > 1)
+        {
+            std::printf("FAILED: %s IDCT is off the reference by more than 1\n", kernel.name);
+            ++failures;
+        }
+    }
+    
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,225 @@
+/// SIMD kernels test
+///
+/// Runs the SSE2 and AVX2 kernels on the same random inputs as the scalar
+/// ones. The YCbCr to RGB conversions must match the scalar conversion
+/// exactly, including the pixels at the end of rows that don't fill a
+/// vector, and must not write past the end of the rows. The IDCTs must
+/// match the floating point reference IDCT within 1.
+///
+/// The AVX2 kernels are skipped on CPUs without AVX2.
+
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "ColorConversion.hpp"
+#include "IDCT.hpp"
+#include "Image.hpp"
+#include "Transform.hpp"
+#include "Utility.hpp"
+
+using namespace kpeg;
+
+/// Bytes past the end of the output rows that must be left untouched
+static const std::size_t GUARD_SIZE = 64;
+
+/// A SIMD color conversion under test
+struct ColorConversionUnderTest
+{
+    const char* name;
+    ColorConversionFunction (*get)(const PixelFormat, const int, const UpsamplingMode);
+};
+
+/// Compare the SIMD color conversions to the scalar one on random rows
+///
+/// @param kernels the SIMD kernels to test
+/// @return the number of mismatches
+static int testColorConversion(const std::vector<ColorConversionUnderTest>& kernels)
+{
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<int> sample(0, 255);
+    
+    const PixelFormat formats[] = { PIXEL_FORMAT_RGB8, PIXEL_FORMAT_BGR8, PIXEL_FORMAT_RGBA8, PIXEL_FORMAT_BGRA8 };
+    const UpsamplingMode modes[] = { UPSAMPLING_SIMPLE, UPSAMPLING_FANCY };
+    
+    // Every count up to a few vectors of the widest kernel, so every
+    // length of the scalar tail is covered, then a few long rows
+    std::vector<std::size_t> counts;
+    
+    for (std::size_t count = 1; count <= 100; ++count)
+        counts.push_back(count);
+    
+    for (std::size_t count : { 255, 256, 257, 1023, 1999 })
+        counts.push_back(count);
+    
+    int mismatches = 0;
+    
+    for (std::size_t count : counts)
+    {
+        // The chrominance rows have a readable sample on each side
+        std::vector<UInt8> Y(count);
+        std::vector<UInt8> chroma[4];
+        
+        for (UInt8& s : Y)
+            s = UInt8(sample(rng));
+        
+        for (auto& row : chroma)
+        {
+            row.resize(count + 2);
+            
+            for (UInt8& s : row)
+                s = UInt8(sample(rng));
+        }
+        
+        for (PixelFormat format : formats)
+        {
+            for (int hFactor = 1; hFactor <= 2; ++hFactor)
+            {
+                for (UpsamplingMode mode : modes)
+                {
+                    std::size_t size = count * getBytesPerPixel(format);
+                    std::vector<UInt8> expected(size + GUARD_SIZE, 0xA5);
+                    
+                    convertYCbCrToRGB(Y.data(), chroma[0].data() + 1, chroma[1].data() + 1,
+                                      chroma[2].data() + 1, chroma[3].data() + 1,
+                                      expected.data(), count, format, hFactor, mode);
+                    
+                    for (const ColorConversionUnderTest& kernel : kernels)
+                    {
+                        std::vector<UInt8> output(size + GUARD_SIZE, 0xA5);
+                        
+                        kernel.get(format, hFactor, mode)(Y.data(), chroma[0].data() + 1, chroma[1].data() + 1,
+                                                          chroma[2].data() + 1, chroma[3].data() + 1,
+                                                          output.data(), count);
+                        
+                        if (output != expected)
+                        {
+                            if (++mismatches <= 10)
+                            {
+                                std::printf("FAILED: %s color conversion differs from the scalar one: "
+                                            "%zu pixels, format %d, hFactor %d, %s upsampling\n",
+                                            kernel.name, count, int(format), hFactor,
+                                            mode == UPSAMPLING_FANCY ? "fancy" : "simple");
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+    
+    for (const ColorConversionUnderTest& kernel : kernels)
+        std::printf("%s color conversion: %zu rows checked\n", kernel.name, counts.size() * 16);
+    
+    return mismatches;
+}
+
+/// A SIMD IDCT under test
+struct IDCTUnderTest
+{
+    const char* name;
+    IDCTFunction idct;
+    bool topLeftOnly;
+};
+
+/// Compare the SIMD IDCTs to the reference IDCT on random blocks
+///
+/// @param kernels the SIMD kernels to test
+/// @return the number of kernels off the reference by more than 1
+static int testIDCT(const std::vector<IDCTUnderTest>& kernels)
+{
+    std::mt19937 rng(1);
+    
+    std::vector<UInt16> unitTable(64, 1);
+    std::vector<UInt16> luminanceTable(64);
+    
+    for (int k = 0; k < 64; ++k)
+        luminanceTable[k] = UInt16(16 + 2 * k);
+    
+    DequantizationTable tables[2];
+    prepareDequantizationTable(unitTable, tables[0]);
+    prepareDequantizationTable(luminanceTable, tables[1]);
+    
+    int failures = 0;
+    
+    for (const IDCTUnderTest& kernel : kernels)
+    {
+        int maxError = 0;
+        
+        for (int t = 0; t < 30000; ++t)
+        {
+            const DequantizationTable& table = tables[t % 2];
+            CoefficientBlock block{};
+            
+            for (int i = 0; i < 64; ++i)
+            {
+                // Sparse blocks, as most blocks are, every fourth block
+                if ((kernel.topLeftOnly && (i / 8 >= 4 || i % 8 >= 4)) || (t % 4 == 0 && i / 8 + i % 8 > 2))
+                    continue;
+                
+                // De-quantized coefficients of 8-bit samples are within 1023
+                int limit = 1023 / table.integerFactors[i];
+                block.coeffs[i] = Int16(std::uniform_int_distribution<int>(-limit, limit)(rng));
+            }
+            
+            block.lastNonZero = 0;
+            
+            for (int k = 0; k < 64; ++k)
+            {
+                if (block.coeffs[ZIGZAG_TO_NATURAL[k]] != 0)
+                    block.lastNonZero = k;
+            }
+            
+            if (kernel.topLeftOnly && block.lastNonZero > IDCT_TOP_LEFT_LAST_ZIGZAG)
+                continue;
+            
+            UInt8 reference[64];
+            UInt8 samples[64];
+            
+            idctFloatReference(block, table, reference, 8);
+            kernel.idct(block, table, samples, 8);
+            
+            for (int i = 0; i < 64; ++i)
+                maxError = std::max(maxError, std::abs(samples[i] - reference[i]));
+        }
+        
+        std::printf("%s IDCT: largest error %d\n", kernel.name, maxError);
+        
+        if (maxError > 1)
+        {
+            std::printf("FAILED: %s IDCT is off the reference by more than 1\n", kernel.name);
+            ++failures;
+        }
+    }
+    
+    return failures;
+}
+
+int main()
+{
+    std::vector<ColorConversionUnderTest> colorConversions;
+    std::vector<IDCTUnderTest> idcts;
+
+#if defined(__SSE2__)
+    colorConversions.push_back({ "SSE2", getYCbCrToRGBFunctionSSE2 });
+    idcts.push_back({ "SSE2", idctSSE2, false });
+    idcts.push_back({ "SSE2 (top left)", idctSSE2TopLeft, true });
+#endif
+    
+    if (utils::isAVX2Supported())
+    {
+#if defined(KPEG_ENABLE_AVX2)
+        colorConversions.push_back({ "AVX2", getYCbCrToRGBFunctionAVX2 });
+        idcts.push_back({ "AVX2", idctAVX2, false });
+        idcts.push_back({ "AVX2 (top left)", idctAVX2TopLeft, true });
+#endif
+    }
+    else
+        std::printf("The CPU doesn't support AVX2, skipping the AVX2 kernels\n");
+    
+    int failures = testColorConversion(colorConversions) + testIDCT(idcts);
+    
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}